@@ -104,5 +104,10 @@ __DEAD void mips_usermode(struct trapframe *tf);
 extern vaddr_t cpustacks[];
 extern vaddr_t cputhreads[];
 
+/*
+ * Array used to find the current page table on a TLB refill.
+ */
+extern vaddr_t cpupagetables[];
+
 
 #endif /* _MIPS_TRAPFRAME_H_ */
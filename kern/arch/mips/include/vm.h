@@ -125,17 +125,21 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * A shootdown drops the entry for one page, mapped with ASID ts_asid
+ * in ASID generation ts_asidgen, and counts itself done in
+ * *ts_pending. Each cpu waits for its shootdowns to be done before
+ * sending more (see vm.c), so a cpu never has more queued than there
+ * are other cpus.
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;
+	uint32_t ts_asid;
+	uint32_t ts_asidgen;
+	volatile unsigned *ts_pending;
 };
 
-#define TLBSHOOTDOWN_MAX 16
+#define TLBSHOOTDOWN_MAX 32
 
 
 #endif /* _MIPS_VM_H_ */
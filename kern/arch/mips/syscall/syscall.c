@@ -37,6 +37,7 @@
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -120,6 +121,10 @@ syscall(struct trapframe *tf)
 		err = sys_fork(tf, &retval);
 		break;
 
+	    case SYS_vfork:
+		err = sys_vfork(tf, &retval);
+		break;
+
 	    case SYS_execv:
 		err = sys_execv(
 			(userptr_t)tf->tf_a0,
@@ -262,6 +267,53 @@ syscall(struct trapframe *tf)
 		break;
 
 
+	    /* memory calls */
+
+#if !OPT_DUMBVM
+	    case SYS_sbrk:
+		{
+			vaddr_t oldbreak;
+
+			err = sys_sbrk((intptr_t)tf->tf_a0, &oldbreak);
+			retval = (int32_t)oldbreak;
+		}
+		break;
+	    case SYS_mmap:
+		{
+			/*
+			 * Like lseek, the offset is 64 bits and has to be
+			 * aligned, so it goes on the stack after fd.
+			 */
+			uint64_t offset;
+			vaddr_t addr;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &offset, sizeof(offset));
+			if (err) {
+				break;
+			}
+
+			err = sys_mmap(tf->tf_a0, tf->tf_a1, tf->tf_a2,
+				       offset, &addr);
+			retval = (int32_t)addr;
+		}
+		break;
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0);
+		break;
+	    case SYS_mprotect:
+		err = sys_mprotect((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+	    case SYS_madvise:
+		err = sys_madvise((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+	    case SYS_mincore:
+		err = sys_mincore((userptr_t)tf->tf_a0, tf->tf_a1,
+				  (userptr_t)tf->tf_a2);
+		break;
+#endif
+
+
 
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
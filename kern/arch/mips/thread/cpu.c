@@ -67,6 +67,13 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * The first level page table of each cpu's current address space, for
+ * the TLB refill fast path in exception-mips1.S, indexed the same way.
+ * Maintained by the VM system (see vm.c); NULL if there is none.
+ */
+vaddr_t cpupagetables[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
@@ -230,9 +237,8 @@ cpu_irqoff(void)
 }
 
 /*
- * Used below.
+ * Interrupts on and off again, to take any that are pending.
  */
-static
 void
 cpu_irqonoff(void)
 {
@@ -30,8 +30,18 @@
 #include <types.h>
 #include <lib.h>
 #include <vm.h>
+#include <mips/tlb.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include "opt-dumbvm.h"
+#if !OPT_DUMBVM
+#include <swap.h>
+#include <pagecache.h>
+#endif
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -43,6 +53,22 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
         unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        unsigned refcount:16; /* number of users sharing the frame (copy-on-write) */
+        unsigned busy:1; /* the frame is being paged out */
+        unsigned pincount:8; /* pins held by faults etc., pinned frames are not paged out */
+        unsigned referenced:1; /* used since the clock hand last passed */
+        unsigned dirty:1; /* modified since it was zero filled or read from swap */
+        unsigned free_block:1; /* first frame of a free buddy block */
+        unsigned order:5; /* log2 of the size of that block */
+
+        /* reverse map, for paging */
+        struct addrspace *owner; /* address space mapping the frame, NULL if none or shared */
+        vaddr_t vaddr; /* user page the frame is mapped at in owner */
+        uint32_t swapslot; /* still valid copy on swap, or FRAME_NOSLOT */
+
+        /* free list links (frame numbers), valid while free_block is set */
+        uint32_t next_free;
+        uint32_t prev_free;
 } ft_entry_t;
 
 
@@ -54,6 +80,63 @@ static uint32_t last_frame;
 #define TRUE 1
 #define FALSE 0
 
+/*
+ * Free frames are managed by a binary buddy allocator. Free memory is
+ * split into naturally aligned blocks of 2^order frames, and the
+ * blocks of each order are kept on a doubly linked list threaded
+ * through the frame table, so single frames can be allocated and
+ * freed in constant time. A freed block is merged with its buddy
+ * whenever that is free too, which keeps large blocks available for
+ * multiframe allocations. Frame 0 holds the exception handlers and is
+ * never free, so it doubles as the end-of-list marker.
+ */
+#define FT_NIL 0
+#define BUDDY_ORDERS 12 /* blocks of up to 2^11 frames (8MB) */
+
+static uint32_t free_head[BUDDY_ORDERS]; /* first free block of each order */
+static uint32_t free_blocks[BUDDY_ORDERS]; /* number of free blocks of each order */
+static uint32_t free_count = 0; /* number of free frames */
+
+/*
+ * Each cpu also keeps a small cache of free single frames in its
+ * struct cpu, so that most alloc_kpages(1)/free_kpages() calls do not
+ * touch frame_table_spinlock at all. An empty cache is refilled, and
+ * a full one drained, FRAME_BATCH frames at a time. Cached frames are
+ * marked allocated with no references, so neither the buddy allocator
+ * nor the pager will touch them.
+ *
+ * Each cache has its own lock, c_framelock, which only its cpu takes
+ * until memory runs out. Then framecache_drain_all() empties every
+ * cpu's cache, before anyone pages out or fails an allocation while
+ * frames sit unused elsewhere. c_framelock comes before
+ * frame_table_spinlock.
+ */
+#define FRAME_BATCH (CPU_FRAMES / 2)
+
+/* frame cache statistics, protected by frame_table_spinlock */
+static struct {
+        uint32_t refills; /* batches taken from the buddy allocator */
+        uint32_t drains; /* batches given back to it */
+        uint32_t drainalls; /* times every cache was emptied */
+} fc_stats;
+
+/*
+ * Pool of frames zeroed in the background by idle cpus, for zero fill
+ * page faults. Pool frames are marked allocated with no references,
+ * like cached frames, and are used for ordinary allocations as well
+ * once the buddy allocator runs dry.
+ */
+#define ZERO_POOL_MAX 64
+
+static paddr_t zero_pool[ZERO_POOL_MAX];
+static unsigned zero_count = 0;
+
+/* zero pool statistics, protected by frame_table_spinlock */
+static struct {
+        uint32_t zeroed; /* frames zeroed by idle cpus */
+        uint32_t hits; /* zero fill requests served from the pool */
+        uint32_t misses; /* zero fill requests that had to bzero inline */
+} zp_stats;
 
 /* frame_table protected by spinlock (interrupt disabling on
  * uniprocessor) as this implementation does not block.
@@ -61,6 +144,114 @@ static uint32_t last_frame;
 
 static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
 
+/* threads waiting for a busy frame to be released sleep here */
+static struct wchan *frame_wchan;
+
+/* the clock hand, where the pager resumes its search for a victim */
+static uint32_t victim_hand;
+
+/* pager statistics, protected by frame_table_spinlock */
+static struct {
+        uint32_t evictions; /* victims chosen */
+        uint32_t scanned; /* frames the clock hand passed over to find them */
+        uint32_t maxscan; /* longest single search */
+        uint32_t failed; /* searches that found nothing to evict */
+} ft_stats;
+
+/* Buddy free lists. Call with frame_table_spinlock held. */
+
+static void free_list_push(uint32_t i, unsigned order)
+{
+        frame_table[i].free_block = TRUE;
+        frame_table[i].order = order;
+        frame_table[i].prev_free = FT_NIL;
+        frame_table[i].next_free = free_head[order];
+        if (free_head[order] != FT_NIL) {
+                frame_table[free_head[order]].prev_free = i;
+        }
+        free_head[order] = i;
+        free_blocks[order]++;
+        free_count += 1 << order;
+}
+
+static void free_list_remove(uint32_t i)
+{
+        unsigned order = frame_table[i].order;
+
+        KASSERT(frame_table[i].free_block == TRUE);
+
+        if (frame_table[i].prev_free != FT_NIL) {
+                frame_table[frame_table[i].prev_free].next_free = frame_table[i].next_free;
+        }
+        else {
+                KASSERT(free_head[order] == i);
+                free_head[order] = frame_table[i].next_free;
+        }
+        if (frame_table[i].next_free != FT_NIL) {
+                frame_table[frame_table[i].next_free].prev_free = frame_table[i].prev_free;
+        }
+        frame_table[i].free_block = FALSE;
+        free_blocks[order]--;
+        free_count -= 1 << order;
+}
+
+/*
+ * Give a single frame back to the buddy allocator, merging it with
+ * its buddy for as long as the buddy is a free block of the same size.
+ */
+static void buddy_free_frame(uint32_t i)
+{
+        uint32_t buddy;
+        unsigned order;
+
+        frame_table[i].allocated = FALSE;
+
+        for (order = 0; order < BUDDY_ORDERS - 1; order++) {
+                buddy = i ^ (1 << order);
+                if (buddy < first_frame || buddy >= last_frame ||
+                    frame_table[buddy].free_block == FALSE ||
+                    frame_table[buddy].order != order) {
+                        break;
+                }
+                free_list_remove(buddy);
+                if (buddy < i) {
+                        i = buddy;
+                }
+        }
+
+        free_list_push(i, order);
+}
+
+/*
+ * Take a free block of 2^ORDER frames, splitting a larger one if
+ * there is none of that size. Returns the first frame, or FT_NIL.
+ */
+static uint32_t buddy_alloc_block(unsigned order)
+{
+        unsigned k;
+        uint32_t i;
+
+        for (k = order; k < BUDDY_ORDERS; k++) {
+                if (free_head[k] != FT_NIL) {
+                        break;
+                }
+        }
+        if (k == BUDDY_ORDERS) {
+                return FT_NIL;
+        }
+
+        i = free_head[k];
+        free_list_remove(i);
+
+        /* give back the upper half until the block is the right size */
+        while (k > order) {
+                k--;
+                free_list_push(i + (1 << k), k);
+        }
+
+        return i;
+}
+
 /*
  * Called very early in system boot to figure out how much physical
  * RAM is available.
@@ -130,6 +321,12 @@ ram_bootstrap(void)
                 /* Mark as allocated as individual pages */
                 frame_table[i].allocated = TRUE;
                 frame_table[i].not_last = FALSE;
+                frame_table[i].free_block = FALSE;
+                frame_table[i].refcount = 1;
+                frame_table[i].busy = FALSE;
+                frame_table[i].pincount = 0;
+                frame_table[i].owner = NULL;
+                frame_table[i].swapslot = FRAME_NOSLOT;
         }                                            
         
         /* 
@@ -138,10 +335,26 @@ ram_bootstrap(void)
         
         first_frame = firstpaddr >> PAGE_BITS;
         
+        KASSERT(first_frame > FT_NIL);
         for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
-                frame_table[i].allocated = FALSE;
+                frame_table[i].allocated = TRUE;
+                frame_table[i].free_block = FALSE;
+                frame_table[i].refcount = 0;
+                frame_table[i].busy = FALSE;
+                frame_table[i].pincount = 0;
+                frame_table[i].owner = NULL;
+                frame_table[i].swapslot = FRAME_NOSLOT;
         }
 
+        /* and hand them to the buddy allocator, which merges them into blocks */
+        for (i = 0; i < BUDDY_ORDERS; i++) {
+                free_head[i] = FT_NIL;
+        }
+        for (i = first_frame; i < last_frame; i++) {
+                buddy_free_frame(i);
+        }
+        victim_hand = first_frame;
+
         
 }
 
@@ -189,90 +402,171 @@ ram_getfirstfree(void)
 }
 
 /*
- * This is a relatively inefficient first-fit allocator. Single pages
- * always fit. Multiframe allocations can suffer from external
- * fragmentation. It is intended to be easy to understand and robust,
- * not efficient.
+ * Refill/drain a cpu's frame cache. Call with its c_framelock held.
  */
 
-
-static paddr_t alloc_one_frame(unsigned int npages)
+static void framecache_refill(struct cpu *c)
 {
-        unsigned int i;
+        uint32_t i;
 
-        /* 
-         * Just scan from the start of the frame_table array for an
-         * unallocated block
-         */
-        
-        KASSERT(npages == 1);
+        spinlock_acquire(&frame_table_spinlock);
+        while (c->c_numframes < FRAME_BATCH) {
+                i = buddy_alloc_block(0);
+                if (i == FT_NIL) {
+                        break;
+                }
+                frame_table[i].allocated = TRUE;
+                frame_table[i].not_last = FALSE;
+                frame_table[i].refcount = 0;
+                c->c_frames[c->c_numframes++] = (paddr_t) (i << PAGE_BITS);
+        }
+        fc_stats.refills++;
+        spinlock_release(&frame_table_spinlock);
+}
 
+static void framecache_drain(struct cpu *c)
+{
         spinlock_acquire(&frame_table_spinlock);
-        for (i =  first_frame; i < last_frame; i++) {
-                if (frame_table[i].allocated == FALSE) {
-                        frame_table[i].allocated = TRUE;
-                        frame_table[i].not_last = FALSE;
+        while (c->c_numframes > CPU_FRAMES - FRAME_BATCH) {
+                buddy_free_frame(c->c_frames[--c->c_numframes] >> PAGE_BITS);
+        }
+        fc_stats.drains++;
+        spinlock_release(&frame_table_spinlock);
+}
 
-                        spinlock_release(&frame_table_spinlock);
+/*
+ * Give back the frames cached by every cpu, for when there are none
+ * left anywhere else. Returns how many there were.
+ */
+static unsigned framecache_drain_all(void)
+{
+        struct cpu *c;
+        unsigned k, n = 0;
 
-                        return (paddr_t) (i << PAGE_BITS);
+        if (!CURCPU_EXISTS()) {
+                return 0;
+        }
+        for (k = 0; k < cpu_count(); k++) {
+                c = cpu_get(k);
+                spinlock_acquire(&c->c_framelock);
+                spinlock_acquire(&frame_table_spinlock);
+                while (c->c_numframes > 0) {
+                        buddy_free_frame(c->c_frames[--c->c_numframes] >> PAGE_BITS);
+                        n++;
                 }
+                spinlock_release(&frame_table_spinlock);
+                spinlock_release(&c->c_framelock);
         }
-        
-        /* Did not find an unallocated frame :-( */
 
+        spinlock_acquire(&frame_table_spinlock);
+        fc_stats.drainalls++;
         spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+
+        return n;
 }
 
-static paddr_t alloc_multiple_frames(unsigned int npages)
+/*
+ * Frames come from the buddy allocator. A multiframe allocation takes
+ * the smallest block that fits and immediately gives back the frames
+ * it does not need, so only whole pages are wasted.
+ */
+
+
+static paddr_t alloc_one_frame(unsigned int npages)
 {
-        unsigned int i,j;
+        struct cpu *c;
+        paddr_t paddr;
+        uint32_t i;
 
+        KASSERT(npages == 1);
 
-        /* scan from 'i' for the number of needed free frames. If an
-         * allocated frame is encountered, restart the scan from after
-         * that point.
-         */
-        
+        if (!CURCPU_EXISTS()) {
+                /* too early in boot for the frame caches */
+                spinlock_acquire(&frame_table_spinlock);
+                i = buddy_alloc_block(0);
+                if (i != FT_NIL) {
+                        frame_table[i].allocated = TRUE;
+                        frame_table[i].not_last = FALSE;
+                        frame_table[i].refcount = 0;
+                }
+                spinlock_release(&frame_table_spinlock);
+                if (i == FT_NIL) {
+                        return (paddr_t) 0;
+                }
+                paddr = (paddr_t) (i << PAGE_BITS);
+        }
+        else {
+                /* if we move to another cpu meanwhile, the lock still
+                   makes it safe to use this one's cache */
+                c = curcpu->c_self;
+                spinlock_acquire(&c->c_framelock);
+                if (c->c_numframes == 0) {
+                        framecache_refill(c);
+                }
+                if (c->c_numframes == 0) {
+                        /* Did not find an unallocated frame :-( */
+                        spinlock_release(&c->c_framelock);
+                        return (paddr_t) 0;
+                }
+                paddr = c->c_frames[--c->c_numframes];
+                spinlock_release(&c->c_framelock);
+                i = paddr >> PAGE_BITS;
+        }
 
+        /* the frame is ours alone, but the clock hand reads every entry */
         spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE && frame_table[i].refcount == 0);
+        frame_table[i].refcount = 1;
+        frame_table[i].referenced = FALSE;
+        frame_table[i].dirty = FALSE;
+        spinlock_release(&frame_table_spinlock);
 
-        i = first_frame; j = 0;
+        return paddr;
+}
 
-        while (i < (last_frame - npages) && j < npages) {
-                if (frame_table[i+j].allocated == TRUE) {
-                        i = i + j + 1; /* continue scan after allocated frame */
-                        j = 0;         /* restart the count */
-                }
-                else {
-                        j = j + 1; /* increment count of free frames */
-                }
+static paddr_t alloc_multiple_frames(unsigned int npages)
+{
+        unsigned int i, j, order;
+
+        for (order = 0; (1U << order) < npages; order++) {
+                /* find the block size */
+        }
+        if (order >= BUDDY_ORDERS) {
+                return (paddr_t) 0;
         }
 
-        if  (j == npages) { /* we exited as we found the number of frames required. */
-                for (j = i; j < i + npages - 1; j++) {
-                        frame_table[j].allocated = TRUE; /* mark frame allocated */
-                        frame_table[j].not_last = TRUE;  /* as a contiguous block */
-                }
-                frame_table[j].allocated = TRUE;
-                frame_table[j].not_last = FALSE;
+        spinlock_acquire(&frame_table_spinlock);
 
+        i = buddy_alloc_block(order);
+        if (i == FT_NIL) {
+                /* Did not find an unallocated contiguous range of frames :-( */
                 spinlock_release(&frame_table_spinlock);
-                
-                return (paddr_t) (i << PAGE_BITS);
+                return (paddr_t) 0;
+        }
+
+        for (j = i; j < i + npages - 1; j++) {
+                frame_table[j].allocated = TRUE; /* mark frame allocated */
+                frame_table[j].not_last = TRUE;  /* as a contiguous block */
+        }
+        frame_table[j].allocated = TRUE;
+        frame_table[j].not_last = FALSE;
+        frame_table[i].refcount = 1; /* the block is shared as a whole */
+
+        /* return the unused tail of the block */
+        for (j = i + npages; j < i + (1U << order); j++) {
+                buddy_free_frame(j);
         }
-        
-        /* Did not find an unallocated contiguous range of frames :-( */
 
         spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+
+        return (paddr_t) (i << PAGE_BITS);
 }
 
 static void free_frames(vaddr_t vaddr)
 {
+        struct cpu *c;
         paddr_t paddr;
-        uint32_t i;
+        uint32_t i, slot;
 
         KASSERT(vaddr != (vaddr_t) NULL);
 
@@ -285,16 +579,85 @@ static void free_frames(vaddr_t vaddr)
         if (frame_table[i].allocated == FALSE) { /* check for double free error */
                 panic("Double free error!!");
         }
+
+        KASSERT(frame_table[i].refcount > 0);
+
+        /* drop one reference, the frames stay in use until the last one goes */
+        frame_table[i].refcount--;
+        if (frame_table[i].refcount > 0) {
+                spinlock_release(&frame_table_spinlock);
+                return;
+        }
         
-        while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
-                frame_table[i].allocated = FALSE;
-                if (frame_table[i].not_last == TRUE) {
-                        i++;
+        KASSERT(frame_table[i].busy == FALSE);
+        KASSERT(frame_table[i].pincount == 0);
+        frame_table[i].owner = NULL;
+        slot = frame_table[i].swapslot;
+        frame_table[i].swapslot = FRAME_NOSLOT;
+
+        /*
+         * A single frame goes into this cpu's cache. It stays marked
+         * allocated with no references, so once the frame table lock
+         * is dropped nobody else looks at it and only the push onto
+         * the cache needs the cache's lock.
+         */
+        if (CURCPU_EXISTS() && frame_table[i].not_last == FALSE) {
+                spinlock_release(&frame_table_spinlock);
+
+                c = curcpu->c_self;
+                spinlock_acquire(&c->c_framelock);
+                if (c->c_numframes == CPU_FRAMES) {
+                        framecache_drain(c);
+                }
+                c->c_frames[c->c_numframes++] = paddr;
+                spinlock_release(&c->c_framelock);
+
+                goto done;
+        }
+
+        while (1) { /* otherwise give the frames back */
+                bool more = frame_table[i].not_last;
+                buddy_free_frame(i);
+                if (!more) {
+                        break;
                 }
+                i++;
         }
         spinlock_release(&frame_table_spinlock);
+
+ done:
+#if !OPT_DUMBVM
+        /* the copy on swap is no use to anyone now */
+        if (slot != FRAME_NOSLOT) {
+                swap_free(slot);
+        }
+#else
+        (void)slot;
+#endif
 }
         
+/*
+ * Take a frame from the zero pool, or return 0 if it is empty.
+ */
+static paddr_t zero_pool_take(void)
+{
+        paddr_t paddr = 0;
+        uint32_t i;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (zero_count > 0) {
+                paddr = zero_pool[--zero_count];
+                i = paddr >> PAGE_BITS;
+                KASSERT(frame_table[i].refcount == 0);
+                frame_table[i].refcount = 1;
+                frame_table[i].referenced = FALSE;
+                frame_table[i].dirty = FALSE;
+        }
+        spinlock_release(&frame_table_spinlock);
+
+        return paddr;
+}
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t
 alloc_kpages(unsigned npages)
@@ -302,9 +665,43 @@ alloc_kpages(unsigned npages)
         paddr_t paddr;
         if (npages > 1 ) {
                 paddr = alloc_multiple_frames(npages);
+                /* the frames we need may be sitting in the cpu caches */
+                if (paddr == 0 && framecache_drain_all() > 0) {
+                        paddr = alloc_multiple_frames(npages);
+                }
         }
         else {
                 paddr = alloc_one_frame(npages);
+                if (paddr == 0) {
+                        /* zeroed frames are still free frames */
+                        paddr = zero_pool_take();
+                }
+                /* and so are frames in other cpus' caches */
+                if (paddr == 0 && framecache_drain_all() > 0) {
+                        paddr = alloc_one_frame(npages);
+                }
+#if !OPT_DUMBVM
+                /*
+                 * Out of frames: page out a user page to make room,
+                 * as long as we are allowed to sleep for the I/O.
+                 * Reclaiming the page cache can sleep too, dropping
+                 * vnode references.
+                 */
+                if (paddr == 0 && !curthread->t_in_interrupt &&
+                    curcpu->c_spinlocks == 0) {
+                        /* cached executable pages nobody maps go first */
+                        if (pagecache_reclaim(FRAME_BATCH) > 0) {
+                                paddr = alloc_one_frame(npages);
+                        }
+                        if (paddr == 0) {
+                                paddr = swap_evict();
+                        }
+                }
+                /* running low: have the pageout thread catch up */
+                if (frame_nfree() < SWAP_FREE_LOW) {
+                        swap_kick();
+                }
+#endif
         }
         
 	if (paddr == 0) {
@@ -319,3 +716,461 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * Allocate a zero filled page, preferably one zeroed ahead of time.
+ */
+vaddr_t
+alloc_zeroed_kpage(void)
+{
+        paddr_t paddr;
+        vaddr_t vaddr;
+
+        paddr = zero_pool_take();
+        if (paddr != 0) {
+                spinlock_acquire(&frame_table_spinlock);
+                zp_stats.hits++;
+                spinlock_release(&frame_table_spinlock);
+                return PADDR_TO_KVADDR(paddr);
+        }
+
+        vaddr = alloc_kpages(1);
+        if (vaddr == 0) {
+                return 0;
+        }
+        bzero((void *)vaddr, PAGE_SIZE);
+
+        spinlock_acquire(&frame_table_spinlock);
+        zp_stats.misses++;
+        spinlock_release(&frame_table_spinlock);
+
+        return vaddr;
+}
+
+/*
+ * Called from the idle loop with interrupts off. Zero one free frame
+ * for the zero pool, unless it is full or memory is short. Returns
+ * true if it did some work, so the caller should take pending
+ * interrupts and check for runnable threads again rather than go to
+ * sleep. One page at a time keeps interrupts from waiting long.
+ */
+bool
+frame_idle_zero(void)
+{
+        uint32_t i;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (zero_count >= ZERO_POOL_MAX || free_count <= ZERO_POOL_MAX) {
+                spinlock_release(&frame_table_spinlock);
+                return false;
+        }
+        i = buddy_alloc_block(0);
+        KASSERT(i != FT_NIL);
+        frame_table[i].allocated = TRUE;
+        frame_table[i].not_last = FALSE;
+        frame_table[i].refcount = 0;
+        spinlock_release(&frame_table_spinlock);
+
+        bzero((void *)PADDR_TO_KVADDR(i << PAGE_BITS), PAGE_SIZE);
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (zero_count < ZERO_POOL_MAX) {
+                zero_pool[zero_count++] = (paddr_t) (i << PAGE_BITS);
+                zp_stats.zeroed++;
+        }
+        else {
+                /* another cpu filled the pool meanwhile */
+                buddy_free_frame(i);
+        }
+        spinlock_release(&frame_table_spinlock);
+
+        return true;
+}
+
+/*
+ * Print the number of free blocks of each size (kernel menu).
+ */
+void
+frame_printfreelists(void)
+{
+        uint32_t counts[BUDDY_ORDERS], nfree, refills, drains, drainalls;
+        unsigned k;
+
+        spinlock_acquire(&frame_table_spinlock);
+        for (k = 0; k < BUDDY_ORDERS; k++) {
+                counts[k] = free_blocks[k];
+        }
+        nfree = free_count;
+        refills = fc_stats.refills;
+        drains = fc_stats.drains;
+        drainalls = fc_stats.drainalls;
+        spinlock_release(&frame_table_spinlock);
+
+        kprintf("Frame allocator: %u of %u frames free in the buddy lists\n", nfree,
+                last_frame - first_frame);
+        for (k = 0; k < BUDDY_ORDERS; k++) {
+                kprintf("    order %2u (%4u pages): %u free\n",
+                        k, 1U << k, counts[k]);
+        }
+        kprintf("Per-cpu frame caches: %u refills, %u drains (batches of %u), "
+                "emptied %u times when memory ran out\n",
+                refills, drains, FRAME_BATCH, drainalls);
+}
+
+/*
+ * Reference counting for frames shared between address spaces
+ * (copy-on-write). A frame is handed out by alloc_kpages() holding a
+ * single reference; free_kpages() drops one and only releases the
+ * frame once the last reference is gone.
+ */
+void
+frame_incref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount > 0);
+        frame_table[i].refcount++;
+        frame_table[i].owner = NULL; /* shared frames are not paged out */
+        spinlock_release(&frame_table_spinlock);
+}
+
+unsigned
+frame_refcount(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+        unsigned count;
+
+        spinlock_acquire(&frame_table_spinlock);
+        count = frame_table[i].refcount;
+        spinlock_release(&frame_table_spinlock);
+
+        return count;
+}
+
+
+#if !OPT_DUMBVM
+
+/*
+ * Paging support.
+ *
+ * A user page frame records the address space and virtual page that
+ * map it (a reverse map), so the pager can find the page table entry
+ * to update when it evicts the frame. Frames without an owner (kernel
+ * memory, frames shared copy-on-write) are never chosen as victims.
+ *
+ * Faults and address space operations pin a frame while they work on
+ * it, and pinned frames are skipped by the pager. The pager in turn
+ * marks its victim busy while writing it out, as does the page merger
+ * while it looks at a page; anyone wanting to pin a busy frame sleeps
+ * until it is let go.
+ *
+ * The MIPS TLB has no reference or dirty bits, so we emulate both.
+ * A frame is marked referenced whenever a fault loads it into the
+ * TLB; the clock hand clears the bit and drops the TLB entry so the
+ * next use faults and sets it again. Pages are mapped read-only until
+ * the first write fault marks them dirty, so clean pages that already
+ * have a copy on swap (or are still all zeroes) can be evicted
+ * without any I/O.
+ */
+
+void
+frametable_bootstrap(void)
+{
+        frame_wchan = wchan_create("frame_table");
+        if (frame_wchan == NULL) {
+                panic("vm: could not create frame table wchan\n");
+        }
+}
+
+/*
+ * Record which address space and page map the frame, and that it has
+ * just been used. Frames shared by several users get no owner.
+ */
+void
+frame_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        if (frame_table[i].refcount == 1) {
+                frame_table[i].owner = as;
+                frame_table[i].vaddr = vaddr & PAGE_FRAME;
+        }
+        else {
+                frame_table[i].owner = NULL;
+        }
+        frame_table[i].referenced = TRUE;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Forget that the frame was used, so the clock takes it on its next
+ * pass unless it is used again before then.
+ */
+void
+frame_deactivate(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (frame_table[i].allocated == TRUE) {
+                frame_table[i].referenced = FALSE;
+        }
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Note that the frame is about to be written, which makes any copy of
+ * it on swap stale.
+ */
+void
+frame_setdirty(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+        uint32_t slot;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].dirty = TRUE;
+        slot = frame_table[i].swapslot;
+        frame_table[i].swapslot = FRAME_NOSLOT;
+        spinlock_release(&frame_table_spinlock);
+
+#if !OPT_DUMBVM
+        if (slot != FRAME_NOSLOT) {
+                swap_free(slot);
+        }
+#else
+        (void)slot;
+#endif
+}
+
+/*
+ * Note that the frame was just read in from swap SLOT and still
+ * matches it. The frame takes over the caller's reference to the slot.
+ */
+void
+frame_setslot(paddr_t paddr, unsigned slot)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].swapslot == FRAME_NOSLOT);
+        frame_table[i].swapslot = slot;
+        frame_table[i].dirty = FALSE;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Pin the frame the page table entry PTE refers to, waiting for any
+ * page-out in progress to finish first. Returns false (and pins
+ * nothing) if the page is not resident.
+ */
+bool
+frame_pin_pte(paddr_t *pte)
+{
+        uint32_t i;
+
+        spinlock_acquire(&frame_table_spinlock);
+        while (1) {
+                if ((*pte & TLBLO_VALID) == 0) {
+                        spinlock_release(&frame_table_spinlock);
+                        return false;
+                }
+                i = *pte >> PAGE_BITS;
+                if (frame_table[i].busy == FALSE) {
+                        break;
+                }
+                wchan_sleep(frame_wchan, &frame_table_spinlock);
+        }
+        KASSERT(frame_table[i].pincount < 255);
+        frame_table[i].pincount++;
+        spinlock_release(&frame_table_spinlock);
+
+        return true;
+}
+
+void
+frame_unpin(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].pincount > 0);
+        frame_table[i].pincount--;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Mark the frame busy as the pager does, if it is the private frame of
+ * page VADDR of AS and nobody is working on it. The page merger
+ * (ksm.c) uses this to keep the owner and the pager off the page table
+ * entry while it looks at the page, and lets go of the frame with
+ * frame_evict_done(PADDR, false).
+ */
+bool
+frame_trybusy(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+        bool ok = false;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (frame_table[i].allocated == TRUE &&
+            frame_table[i].refcount == 1 &&
+            frame_table[i].owner == as &&
+            frame_table[i].vaddr == (vaddr & PAGE_FRAME) &&
+            frame_table[i].busy == FALSE &&
+            frame_table[i].pincount == 0) {
+                frame_table[i].busy = TRUE;
+                ok = true;
+        }
+        spinlock_release(&frame_table_spinlock);
+
+        return ok;
+}
+
+/*
+ * Choose a user frame to evict with the clock (second chance)
+ * algorithm. The victim is returned marked busy, along with the
+ * address space and page that map it, whether it needs writing out,
+ * and the swap slot already holding its contents (if any). Returns 0
+ * if there is nothing we can evict.
+ */
+paddr_t
+frame_pick_victim(struct addrspace **as, vaddr_t *vaddr,
+                  bool *dirty, unsigned *slot)
+{
+        uint32_t i, n, nframes;
+
+        nframes = last_frame - first_frame;
+
+        spinlock_acquire(&frame_table_spinlock);
+
+        /* two sweeps: the first may only clear reference bits */
+        for (n = 0; n < 2 * nframes; n++) {
+                i = victim_hand;
+                victim_hand++;
+                if (victim_hand >= last_frame) {
+                        victim_hand = first_frame;
+                }
+
+                if (frame_table[i].allocated == FALSE ||
+                    frame_table[i].owner == NULL ||
+                    frame_table[i].refcount != 1 ||
+                    frame_table[i].busy == TRUE ||
+                    frame_table[i].pincount > 0) {
+                        continue;
+                }
+
+                if (frame_table[i].referenced == TRUE) {
+                        /* second chance; make the next use fault */
+                        frame_table[i].referenced = FALSE;
+                        vm_tlb_age(frame_table[i].owner,
+                                   frame_table[i].vaddr);
+                        continue;
+                }
+
+                frame_table[i].busy = TRUE;
+                *as = frame_table[i].owner;
+                *vaddr = frame_table[i].vaddr;
+                *dirty = frame_table[i].dirty;
+                *slot = frame_table[i].swapslot;
+
+                ft_stats.evictions++;
+                ft_stats.scanned += n + 1;
+                if (n + 1 > ft_stats.maxscan) {
+                        ft_stats.maxscan = n + 1;
+                }
+                spinlock_release(&frame_table_spinlock);
+
+                return (paddr_t) (i << PAGE_BITS);
+        }
+
+        ft_stats.failed++;
+        ft_stats.scanned += n;
+        spinlock_release(&frame_table_spinlock);
+
+        return (paddr_t) 0;
+}
+
+/*
+ * The pager is done with its victim. If the page was evicted the
+ * frame is handed on for reuse (still holding its one reference),
+ * otherwise it goes back to its owner.
+ */
+void
+frame_evict_done(paddr_t paddr, bool evicted)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].busy == TRUE);
+        if (evicted) {
+                /* any swap slot was handed to the page table entry */
+                frame_table[i].owner = NULL;
+                frame_table[i].swapslot = FRAME_NOSLOT;
+                frame_table[i].referenced = FALSE;
+                frame_table[i].dirty = FALSE;
+        }
+        frame_table[i].busy = FALSE;
+        wchan_wakeall(frame_wchan, &frame_table_spinlock);
+        spinlock_release(&frame_table_spinlock);
+}
+
+/* number of frames user pages can live in */
+unsigned
+frame_count(void)
+{
+        return last_frame - first_frame;
+}
+
+/*
+ * Return roughly how many frames are free, counting zeroed ones and
+ * the ones cached by every cpu. Taken without the locks: this is only
+ * a hint for the pageout thread's watermarks.
+ */
+unsigned
+frame_nfree(void)
+{
+        unsigned k, n = free_count + zero_count;
+
+        if (CURCPU_EXISTS()) {
+                for (k = 0; k < cpu_count(); k++) {
+                        n += cpu_get(k)->c_numframes;
+                }
+        }
+        return n;
+}
+
+void
+frame_printstats(void)
+{
+        uint32_t evictions, scanned, maxscan, failed, nfree;
+        uint32_t nzero, zeroed, hits, misses;
+
+        spinlock_acquire(&frame_table_spinlock);
+        nfree = free_count;
+        nzero = zero_count;
+        zeroed = zp_stats.zeroed;
+        hits = zp_stats.hits;
+        misses = zp_stats.misses;
+        evictions = ft_stats.evictions;
+        scanned = ft_stats.scanned;
+        maxscan = ft_stats.maxscan;
+        failed = ft_stats.failed;
+        spinlock_release(&frame_table_spinlock);
+
+        kprintf("Frames: %u of %u free (not counting per-cpu caches)\n", nfree, last_frame - first_frame);
+        kprintf("Pager: %u evictions, %u frames scanned (%u.%02u per eviction, max %u), %u failed searches\n",
+                evictions, scanned,
+                evictions ? scanned / evictions : 0,
+                evictions ? (scanned * 100 / evictions) % 100 : 0,
+                maxscan, failed);
+        kprintf("Zero pool: %u of %u frames ready, %u zeroed while idle, %u hits, %u misses\n",
+                nzero, ZERO_POOL_MAX, zeroed, hits, misses);
+}
+
+#endif /* !OPT_DUMBVM */
@@ -35,6 +35,7 @@
  */
 
 
+#include <array.h>
 #include <vm.h>
 #include "opt-dumbvm.h"
 
@@ -46,10 +47,91 @@ typedef struct _region {
         size_t size; // the size of the region
         uint32_t flags; // the flags associated with the region
         uint32_t prevFlags; // used in prepareLoad/completeLoad to keep track of original flag values
-        struct _region *next; // pointer to the next region
+        struct vnode *vnode; // executable the region is paged in from, or NULL
+        vaddr_t filebase; // address the file data starts at
+        off_t offset; // offset of the file data in the executable
+        size_t filesize; // length of the file data, the rest is zero filled
+        bool mmapped; // made by mmap(); writes to a file mapping go back to the file
+        bool forked; // a file mapping inherited through fork(); writes stay private
+        bool loadshared; // a page shared by two segments, read in at load time
+        int advice; // access pattern from madvise() (MADV_*)
 } region;
 
-#define USERSTACK_SIZE  16
+// The regions of an address space, sorted by base address
+#ifndef ASINLINE
+#define ASINLINE INLINE
+#endif
+
+DECLARRAY_BYTYPE(regionarray, struct _region, ASINLINE);
+DEFARRAY_BYTYPE(regionarray, struct _region, ASINLINE);
+
+/*
+ * The stack is a region that grows down on demand, up to the stack
+ * limit of the address space (USERSTACK_LIMIT pages unless changed
+ * with as_set_stacklimit). Nothing else may be mapped within
+ * USERSTACK_GUARD pages below the lowest the stack may grow to.
+ */
+#define USERSTACK_LIMIT  256
+#define USERSTACK_GUARD  16
+
+/*
+ * Page table layout: the top 10 bits of a virtual address index the
+ * first level table, the next 10 bits the second level.
+ */
+#define PT_LVL1(vaddr) ((vaddr) >> 22)
+#define PT_LVL2(vaddr) (((vaddr) >> 12) & 0x3ff)
+
+/*
+ * Bit I of the page table map of an address space is set while it has
+ * level 2 table I, so walks of the page table skip the holes quickly.
+ */
+#define PT_MAPWORDS    (1024 / 32)
+#define PT_MAPBIT(i)   ((uint32_t)1 << ((i) % 32))
+
+/*
+ * Page table entries are in TLBLO format for resident pages. The low
+ * bits (below TLBLO_GLOBAL) are ignored by the hardware, so we use
+ * them for software state. A swapped out page has TLBLO_VALID clear,
+ * PTE_SWAPPED set, and its swap slot in place of the frame number.
+ */
+#define PTE_SWAPPED      0x00000001
+#define PTE_SLOT(pte)    ((pte) >> 12)
+
+/*
+ * PTE_TRAP on a resident entry makes the TLB refill fast path leave
+ * the entry to vm_fault(), which clears it. The pager sets it to see
+ * the next use of a page.
+ */
+#define PTE_TRAP         0x00000002
+#define PTE_MKSWAP(slot) (((paddr_t)(slot) << 12) | PTE_SWAPPED)
+
+/*
+ * PTE_FDIRTY marks a page of a file mapping that has been written
+ * since it was last written back to the file. It stays set while the
+ * page is out on swap.
+ */
+#define PTE_FDIRTY       0x00000004
+
+/*
+ * PTE_DROPPED (PTE_TRAP on its own) is left by the pager in place of a
+ * clean page it dropped without writing it anywhere, to be filled
+ * afresh by the next fault. The entry stays non-zero so the pager never
+ * changes how many entries of a level 2 table are in use (see ptcount).
+ * PTE_EMPTY is true of such an entry and of a zero one.
+ */
+#define PTE_DROPPED      PTE_TRAP
+#define PTE_EMPTY(pte)   (((pte) & (TLBLO_VALID | PTE_SWAPPED)) == 0)
+
+/*
+ * PTE_AHEAD marks a resident page read in from swap along with another
+ * page's fault, until its first use (see vm_swap_in()). It comes with
+ * PTE_TRAP, so that use shows up in vm_fault().
+ */
+#define PTE_AHEAD        0x00000008
+
+/* A resident entry mapping the shared zero page (see vm.c) */
+#define PTE_ZEROPAGE(pte) \
+        (((pte) & PTE_SWAPPED) == 0 && ((pte) & PAGE_FRAME) == vm_zeropage)
 
 
 /*
@@ -74,18 +156,64 @@ struct addrspace {
         // 2 level page table
         paddr_t **pagetable;
 
+        // the non-zero entries in each level 2 table (a table is freed
+        // when it has none left), and which level 2 tables there are
+        uint16_t ptcount[1024];
+        uint32_t ptmap[PT_MAPWORDS];
+
         // loading bit, set when prepare_load is called
         uint32_t loadingbit;
 
-        // linked list of regions
-        region *regions;
+        // TLB address space ID, valid in ASID generation asid_gen, and
+        // the cpus that have used it, whose TLBs may hold its entries
+        uint32_t asid;
+        uint32_t asid_gen;
+        uint32_t tlbcpus;
+
+        // regions sorted by base, which never overlap
+        struct regionarray regions;
+
+        // region the last lookup found, tried first next time
+        region *lastregion;
 
         // address for the heap
         vaddr_t heap;
 
+        // the next address space on the list of them all, and the
+        // process it belongs to (for vmps)
+        struct addrspace *next;
+        pid_t pid;
+
+        // as_walkall() calls looking at the page table, which keep it
+        // and the address space in place (protected by the list lock)
+        unsigned walkers;
+
+        // the stack region, which grows down, and how far it may grow
+        region *stackregion;
+        size_t stacklimit;
+
+        // the heap region once loading is done, and the current break
+        // (the end of the heap, which need not be page aligned)
+        region *heapregion;
+        vaddr_t heapbreak;
+
+        // pages read ahead from swap that were used since the last
+        // read, which sets the next read-ahead window (see vm.c)
+        unsigned aheadused;
+
 #endif
 };
 
+/*
+ * Memory use of an address space, from as_getstats().
+ */
+struct as_stats {
+        unsigned resident; // pages in memory
+        unsigned swapped; // pages out on swap
+        unsigned shared; // resident pages sharing a frame (COW, page cache, zero page)
+        unsigned ptpages; // pages of page table
+};
+
 /*
  * Functions in addrspace.c:
  *
@@ -111,7 +239,15 @@ struct addrspace {
  *                the way this works if implementing user-level threads.
  *
  *    as_define_region - set up a region of memory within the address
- *                space.
+ *                space. Fails with EINVAL if it overlaps another one,
+ *                except for a page shared by two executable segments.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL.
+ *
+ *    as_define_file - back the region containing VADDR with FILESIZE
+ *                bytes of the executable V from OFFSET on, to be read
+ *                in a page at a time as the pages are first touched
+ *                (a shared page is read in at once).
  *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
@@ -119,10 +255,53 @@ struct addrspace {
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes, returning
+ *                the old end. Pages the heap shrinks away from are
+ *                freed at once.
+ *
+ *    as_unmap  - free the pages from START up to END, leaving the
+ *                regions as they are, so they read back as zeros.
+ *
+ *    as_mmap   - map LENGTH bytes of the file V from OFFSET on (or
+ *                zeros if V is NULL) at an unused address, returned
+ *                in RET. Writes to a file mapping go back to the file.
+ *
+ *    as_munmap - remove the mapping starting at VADDR (all the pieces
+ *                mprotect may have split it into), writing back
+ *                whatever was written to it.
+ *
+ *    as_mprotect - change the protection of the pages from VADDR to
+ *                VADDR + LEN, splitting regions as needed.
+ *
+ *    as_madvise - act on advice about how the pages from VADDR to
+ *                VADDR + LEN will be used.
+ *
+ *    as_mincore - set VEC[i] to 1 if page i of the NPAGES from VADDR
+ *                on is resident, else 0.
+ *
+ *    as_getstats - count the pages of an address space.
+ *
+ *    as_bootstrap - set up the list of all address spaces.
+ *
+ *    as_printall - print the memory use of every address space (vmps
+ *                menu command).
+ *
+ *    as_walkall - call FN on every page table entry in use in every
+ *                address space, one address space at a time.
+ *
+ *    as_sync   - write back the written pages of every mapping of V
+ *                (or of every file if V is NULL).
+ *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_grow_stack - grow the stack down to cover VADDR if it may, and
+ *                return the stack region, or NULL.
+ *
+ *    as_set_stacklimit - set the stack limit, in pages, of address
+ *                spaces created from now on (vmstack menu command).
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -138,9 +317,34 @@ int               as_define_region(struct addrspace *as,
                                    int readable,
                                    int writeable,
                                    int executable);
+region           *as_find_region(struct addrspace *as, vaddr_t vaddr);
+int               as_define_file(struct addrspace *as, vaddr_t vaddr,
+                                 struct vnode *v, off_t offset,
+                                 size_t filesize);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+region           *as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+int               as_set_stacklimit(unsigned npages);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+void              as_unmap(struct addrspace *as, vaddr_t start, vaddr_t end);
+int               as_mmap(struct addrspace *as, size_t length, int prot,
+                          struct vnode *v, off_t offset, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr);
+int               as_sync(struct addrspace *as, struct vnode *v);
+int               as_mprotect(struct addrspace *as, vaddr_t vaddr, size_t len,
+                              int prot);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len,
+                             int advice);
+int               as_mincore(struct addrspace *as, vaddr_t vaddr,
+                             unsigned npages, unsigned char *vec);
+void              as_getstats(struct addrspace *as, struct as_stats *st);
+void              as_bootstrap(void);
+void              as_printall(void);
+void              as_walkall(void (*fn)(struct addrspace *, vaddr_t,
+                                        paddr_t *, void *),
+                             void *data);
 
 
 /*
@@ -46,6 +46,9 @@
  * a pointer with a fixed address and a per-cpu mapping in the MMU.
  */
 
+/* Size of the per-cpu free frame cache. */
+#define CPU_FRAMES 32
+
 struct cpu {
 	/*
 	 * Fixed after allocation.
@@ -62,6 +65,22 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Used by this cpu, and drained by others when memory runs out.
+	 * Protected by c_framelock.
+	 * Free frames cached by the frame allocator (see unsw.c).
+	 */
+	paddr_t c_frames[CPU_FRAMES];	/* Cached frames */
+	unsigned c_numframes;		/* Number of entries in c_frames */
+	struct spinlock c_framelock;
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 * TLB address space IDs (see vm.c).
+	 */
+	unsigned c_asid;		/* ID of the active address space */
+	unsigned c_asidgen;		/* ID generation of the TLB contents */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -121,9 +140,13 @@ void cpu_identify(char *buf, size_t max);
  * Hardware-level interrupt on/off, for the current CPU.
  *
  * These should only be used by the spl code.
+ *
+ * cpu_irqonoff turns interrupts on just long enough to take any that
+ * are pending and off again, for the idle loop.
  */
 void cpu_irqoff(void);
 void cpu_irqon(void);
+void cpu_irqonoff(void);
 
 /*
  * Idle or shut down (respectively) the processor.
@@ -142,6 +165,15 @@ void cpu_irqon(void);
 void cpu_idle(void);
 void cpu_halt(void);
 
+/*
+ * The cpus in the system, for code that has to visit each of them.
+ *
+ * cpu_count returns how many there are; cpu_get returns the one with
+ * c_number NUMBER.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned number);
+
 /*
  * Interprocessor interrupts.
  *
@@ -0,0 +1,19 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Protection bits for mmap() and mprotect(), and advice for madvise(),
+ * which libc defines in <unistd.h>.
+ */
+
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+
+#define MADV_NORMAL     0    /* No special treatment */
+#define MADV_RANDOM     1    /* Expect random access: no fault-around */
+#define MADV_SEQUENTIAL 2    /* Expect sequential access: map ahead, evict behind */
+#define MADV_WILLNEED   3    /* Expect access soon: read the pages in now */
+#define MADV_DONTNEED   4    /* Done with the pages: free them now */
+
+
+#endif /* _KERN_MMAN_H_ */
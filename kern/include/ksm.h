@@ -0,0 +1,29 @@
+#ifndef _KSM_H_
+#define _KSM_H_
+
+/*
+ * Same-page merging.
+ *
+ * When turned on, a kernel thread goes through the resident private
+ * pages of every process every KSM_INTERVAL seconds, and maps pages
+ * with the same contents to one frame, read-only, freeing the others.
+ * The frame is then shared like any copy-on-write frame, so the first
+ * write to a merged page gets a private copy again. Pages that are all
+ * zeroes are mapped to the zero page.
+ *
+ *    ksm_bootstrap     - set up; called from vm_bootstrap().
+ *
+ *    ksm_enable        - turn merging on or off (ksm menu command).
+ *                        The thread is started the first time.
+ *
+ *    ksm_printstats    - print merging counters and the time spent
+ *                        scanning.
+ */
+
+#define KSM_INTERVAL 2
+
+void ksm_bootstrap(void);
+int  ksm_enable(bool on);
+void ksm_printstats(void);
+
+#endif /* _KSM_H_ */
@@ -0,0 +1,45 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for executables.
+ *
+ * Read-only pages read in from an executable are kept in a cache
+ * keyed by (vnode, file offset), so every process running the same
+ * binary maps the same frames. The cache holds a reference to each
+ * frame and to each vnode; mappings hold references to the frames
+ * like any other shared (copy-on-write) frame.
+ *
+ *    pagecache_lookup  - return the cached frame for page OFFSET of V
+ *                        with a reference added for the caller, or 0.
+ *
+ *    pagecache_insert  - cache PADDR, just read from page OFFSET of V,
+ *                        and return the frame the caller should map.
+ *                        That is PADDR unless another fault cached the
+ *                        page first, in which case PADDR is freed.
+ *
+ *    pagecache_reclaim - drop up to MAX cached pages no process has
+ *                        mapped. Returns the number dropped. Called
+ *                        by alloc_kpages() when memory runs out.
+ *
+ *    pagecache_invalidate - drop every cached page of V. Called after
+ *                        V is written or truncated, so that the next
+ *                        exec reads the new contents. Processes
+ *                        already running keep the pages they have
+ *                        mapped, as if the file had been replaced.
+ *
+ *    pagecache_printstats - print cache counters.
+ *
+ * The cache is only used for read-only executable regions, whose
+ * pages are never written back.
+ */
+
+struct vnode;
+
+paddr_t  pagecache_lookup(struct vnode *v, off_t offset);
+paddr_t  pagecache_insert(struct vnode *v, off_t offset, paddr_t paddr);
+unsigned pagecache_reclaim(unsigned max);
+void     pagecache_invalidate(struct vnode *v);
+void     pagecache_printstats(void);
+
+#endif /* _PAGECACHE_H_ */
@@ -40,6 +40,7 @@
 #include <thread.h> /* required for struct threadarray */
 
 struct addrspace;
+struct semaphore;
 struct vnode;
 
 /*
@@ -60,6 +61,8 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct semaphore *p_vforksem;	/* if p_addrspace is borrowed (vfork),
+					   V'd when it is given back */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -77,8 +80,18 @@ void proc_bootstrap(void);
 /* Create a fresh process for use by runprogram(). */
 int proc_create_runprogram(const char *name, struct proc **ret);
 
-/* Create a fresh process for use by fork() */
-int proc_fork(struct proc **ret);
+/*
+ * Create a fresh process for use by fork(), or for vfork() if VFORKSEM
+ * is not NULL: then the new process borrows the current address space
+ * instead of copying it, and V's VFORKSEM when it gives it back.
+ */
+int proc_fork(struct semaphore *vforksem, struct proc **ret);
+
+/*
+ * Give back the address space a vfork child borrowed, if it did.
+ * Returns true if so, in which case it must not be destroyed.
+ */
+bool proc_vforkdone(struct proc *proc);
 
 /* Undo proc_fork if nothing's run in the new process yet. */
 void proc_unfork(struct proc *proc);
@@ -0,0 +1,63 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap (backing store) for the VM system.
+ *
+ * Pages are stored in page-sized slots on a raw disk device attached
+ * with vfs_swapon(). Slots are reference counted because a fork can
+ * leave the same swapped-out page in more than one page table. Pages
+ * that compress well are kept compressed in a pool of SWAP_ZPOOL_PAGES
+ * pages of memory instead of being written to their slot on disk.
+ *
+ *    swap_bootstrap - attach SWAP_DEVICE. If that fails the system
+ *                     runs without swap.
+ *
+ *    swap_size    - return the number of slots, 0 without swap.
+ *
+ *    swap_cluster - find the slots after SLOT worth reading in with
+ *                   it: ones on disk holding pages last paged out of
+ *                   the same address space, up to a maximum.
+ *
+ *    swap_in      - read N slots from SLOT on into the frames at
+ *                   PADDRS, in one I/O. Only a single slot may be
+ *                   read from the pool.
+ *
+ *    swap_incref  - add a reference to SLOT.
+ *
+ *    swap_free    - drop a reference to SLOT, releasing it if unused.
+ *
+ *    swap_evict   - page out a victim frame and hand it back for
+ *                   reuse, or return 0 if there is nothing to evict.
+ *                   Called by alloc_kpages() when memory runs out
+ *                   before the pageout thread has caught up.
+ *
+ *    swap_kick    - wake the pageout thread. alloc_kpages() calls this
+ *                   when fewer than SWAP_FREE_LOW frames are free; the
+ *                   thread then evicts pages, SWAP_CLUSTER at a time
+ *                   with each run of dirty pages written in one I/O,
+ *                   until SWAP_FREE_HIGH frames are free.
+ *
+ *    swap_printstats - print paging I/O counters.
+ */
+
+struct addrspace;
+
+#define SWAP_DEVICE "lhd0"
+#define SWAP_ZPOOL_PAGES 32
+#define SWAP_CLUSTER 8
+#define SWAP_FREE_LOW 32
+#define SWAP_FREE_HIGH 64
+
+void    swap_bootstrap(void);
+unsigned swap_size(void);
+unsigned swap_cluster(unsigned slot, struct addrspace *as, vaddr_t *vaddrs,
+                      unsigned max);
+int     swap_in(unsigned slot, const paddr_t *paddrs, unsigned n);
+void    swap_incref(unsigned slot);
+void    swap_free(unsigned slot);
+paddr_t swap_evict(void);
+void    swap_kick(void);
+void    swap_printstats(void);
+
+#endif /* _SWAP_H_ */
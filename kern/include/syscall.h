@@ -66,6 +66,7 @@ int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
@@ -92,4 +93,11 @@ int sys_fstat(int fd, userptr_t statptr);
 int sys_fsync(int fd);
 int sys_ftruncate(int fd, off_t len);
 
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(size_t length, int prot, int fd, off_t offset, vaddr_t *retval);
+int sys_munmap(userptr_t addr);
+int sys_mprotect(userptr_t addr, size_t len, int prot);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_mincore(userptr_t addr, size_t len, userptr_t vec);
+
 #endif /* _SYSCALL_H_ */
@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -51,10 +53,63 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/* TLB management with address space IDs (see vm.c) */
+void vm_tlb_activate(struct addrspace *as);
+void vm_tlb_forget(struct addrspace *as);
+void vm_tlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+void vm_tlb_deactivate(struct addrspace *as);
+void vm_tlb_trap(struct addrspace *as, vaddr_t vaddr);
+void vm_tlb_age(struct addrspace *as, vaddr_t vaddr);
+
+/* Write back a written page of a file mapping (see vm.c) */
+struct _region;
+int vm_writeback(struct addrspace *as, struct _region *r, vaddr_t page);
+
+/* Read in a page ahead of use (madvise WILLNEED, see vm.c) */
+int vm_prefault(struct addrspace *as, struct _region *r, vaddr_t page);
+
+/* Frame mapped read-only for untouched anonymous pages (vm.c) */
+extern paddr_t vm_zeropage;
+
+/* Print paging statistics */
+void vm_printstats(void);
+
+/* Set the fault-around window, in pages (vmfa menu command) */
+#define VM_FAULTAROUND_MAX 16
+int vm_set_faultaround(unsigned npages);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/* Allocate a zero filled page; zero free pages while idle (unsw.c) */
+vaddr_t alloc_zeroed_kpage(void);
+bool frame_idle_zero(void);
+
+/* Share/query a frame between address spaces (copy-on-write) */
+void frame_incref(paddr_t paddr);
+unsigned frame_refcount(paddr_t paddr);
+
+/* Print free block counts of the buddy allocator (kh menu command) */
+void frame_printfreelists(void);
+
+/* Frame table support for paging (see unsw.c) */
+#define FRAME_NOSLOT 0xffffffff
+void frametable_bootstrap(void);
+void frame_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void frame_setdirty(paddr_t paddr);
+void frame_setslot(paddr_t paddr, unsigned slot);
+void frame_deactivate(paddr_t paddr);
+bool frame_pin_pte(paddr_t *pte);
+void frame_unpin(paddr_t paddr);
+bool frame_trybusy(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+paddr_t frame_pick_victim(struct addrspace **as, vaddr_t *vaddr,
+                          bool *dirty, unsigned *slot);
+void frame_evict_done(paddr_t paddr, bool evicted);
+unsigned frame_count(void);
+unsigned frame_nfree(void);
+void frame_printstats(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
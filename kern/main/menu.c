@@ -45,8 +45,13 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <ksm.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
+#include "opt-unsw.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -467,10 +472,86 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if OPT_UNSW
+	frame_printfreelists();
+#endif
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_vmstack(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: vmstack pages\n");
+		return EINVAL;
+	}
+
+	if (as_set_stacklimit(atoi(args[1]))) {
+		kprintf("vmstack: bad stack limit\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_vmps(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	as_printall();
 
 	return 0;
 }
 
+static
+int
+cmd_ksm(int nargs, char **args)
+{
+	if (nargs != 2 || (strcmp(args[1], "on") && strcmp(args[1], "off"))) {
+		kprintf("Usage: ksm on|off\n");
+		return EINVAL;
+	}
+
+	return ksm_enable(strcmp(args[1], "on") == 0);
+}
+
+static
+int
+cmd_vmfaultaround(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: vmfa pages\n");
+		return EINVAL;
+	}
+
+	if (vm_set_faultaround(atoi(args[1]))) {
+		kprintf("vmfa: window must be a power of two from 1 to %d pages\n",
+			VM_FAULTAROUND_MAX);
+		return EINVAL;
+	}
+
+	return 0;
+}
+#endif
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -566,6 +647,8 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] Frame allocator timing test   ",
+	"[km6] Buddy allocator test          ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -606,6 +689,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if !OPT_DUMBVM
+	"[vm] VM paging stats                ",
+	"[vmfa] Set VM fault-around window   ",
+	"[vmps] Memory use of each process   ",
+	"[vmstack] Set stack limit (pages)   ",
+	"[ksm] Merge identical pages on/off  ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -657,6 +747,13 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if !OPT_DUMBVM
+	{ "vm",         cmd_vmstats },
+	{ "vmfa",       cmd_vmfaultaround },
+	{ "vmps",       cmd_vmps },
+	{ "vmstack",    cmd_vmstack },
+	{ "ksm",        cmd_ksm },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -667,6 +764,8 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
+	{ "km6",	kmalloctest6 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
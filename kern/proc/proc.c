@@ -90,6 +90,7 @@ proc_create(const char *name)
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_vforksem = NULL;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -179,7 +180,11 @@ proc_destroy(struct proc *proc)
 			as = proc->p_addrspace;
 			proc->p_addrspace = NULL;
 		}
-		as_destroy(as);
+
+		/* A vfork child only gives back its parent's. */
+		if (!proc_vforkdone(proc)) {
+			as_destroy(as);
+		}
 	}
 
 	KASSERT(proc->p_pid == INVALID_PID);
@@ -263,7 +268,7 @@ proc_create_runprogram(const char *name, struct proc **ret)
  * (the caller decides that).
  */
 int
-proc_fork(struct proc **ret)
+proc_fork(struct semaphore *vforksem, struct proc **ret)
 {
 	struct proc *newproc;
 	struct addrspace *as;
@@ -293,7 +298,13 @@ proc_fork(struct proc **ret)
 
 	/* VM fields */
 	as = proc_getas();
-	if (as != NULL) {
+	if (vforksem != NULL) {
+		/* borrowed until we exec or exit; the parent waits */
+		KASSERT(as != NULL);
+		newproc->p_addrspace = as;
+		newproc->p_vforksem = vforksem;
+	}
+	else if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
 		if (result) {
 			pid_unalloc(newproc->p_pid);
@@ -301,6 +312,9 @@ proc_fork(struct proc **ret)
 			proc_destroy(newproc);
 			return result;
 		}
+#if !OPT_DUMBVM
+		newproc->p_addrspace->pid = newproc->p_pid;
+#endif
 	}
 
 	/* VFS fields */
@@ -308,8 +322,7 @@ proc_fork(struct proc **ret)
 	if (tbl != NULL) {
 		result = filetable_copy(tbl, &newproc->p_filetable);
 		if (result) {
-			as_destroy(newproc->p_addrspace);
-			newproc->p_addrspace = NULL;
+			/* proc_destroy disposes of the address space */
 			pid_unalloc(newproc->p_pid);
 			newproc->p_pid = INVALID_PID;
 			proc_destroy(newproc);
@@ -333,6 +346,25 @@ proc_fork(struct proc **ret)
 	return 0;
 }
 
+/*
+ * Give back the address space PROC borrowed from its parent with
+ * vfork, which it must no longer be using, and let the parent go on.
+ * The parent owns the semaphore and may destroy it as soon as it
+ * wakes, so we forget it first.
+ */
+bool
+proc_vforkdone(struct proc *proc)
+{
+	struct semaphore *sem = proc->p_vforksem;
+
+	if (sem == NULL) {
+		return false;
+	}
+	proc->p_vforksem = NULL;
+	V(sem);
+	return true;
+}
+
 /*
  * Undo proc_fork if nothing's run in the new process yet.
  */
@@ -482,5 +514,10 @@ proc_setas(struct addrspace *newas)
 	oldas = proc->p_addrspace;
 	proc->p_addrspace = newas;
 	spinlock_release(&proc->p_lock);
+#if !OPT_DUMBVM
+	if (newas != NULL) {
+		newas->pid = proc->p_pid;
+	}
+#endif
 	return oldas;
 }
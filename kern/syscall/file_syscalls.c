@@ -48,6 +48,8 @@
 #include <openfile.h>
 #include <filetable.h>
 #include <syscall.h>
+#include <pagecache.h>
+#include "opt-dumbvm.h"
 
 /*
  * open() - get the path with copyinstr, then use openfile_open and
@@ -149,6 +151,12 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 	result = (rw == UIO_READ) ?
 		VOP_READ(file->of_vnode, &useruio) :
 		VOP_WRITE(file->of_vnode, &useruio);
+#if !OPT_DUMBVM
+	if (rw == UIO_WRITE) {
+		/* even a failed write may have changed the file */
+		pagecache_invalidate(file->of_vnode);
+	}
+#endif
 	if (result) {
 		goto fail;
 	}
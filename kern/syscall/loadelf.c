@@ -42,8 +42,8 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * Unless dumbvm is in use, segments are not actually read here: each
+ * one is mapped with as_define_file and paged in on demand.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -59,6 +59,10 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include <kern/stat.h>
+#include "opt-dumbvm.h"
+
+#if OPT_DUMBVM
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -145,6 +149,46 @@ load_segment(struct addrspace *as, struct vnode *v,
 	return result;
 }
 
+#else
+
+/*
+ * Map a segment at virtual address VADDR, as for load_segment, but
+ * leave the VM system to read each page from the file on first use.
+ * The file is checked to be long enough now, so that a truncated
+ * executable is still rejected at exec time.
+ */
+static
+int
+map_segment(struct addrspace *as, struct vnode *v,
+	    off_t offset, vaddr_t vaddr,
+	    size_t memsize, size_t filesize)
+{
+	struct stat st;
+	int result;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	if (offset + (off_t)filesize > st.st_size) {
+		/* short file; problem with executable? */
+		kprintf("ELF: segment past end of file - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	return as_define_file(as, vaddr, v, offset, filesize);
+}
+
+#endif /* OPT_DUMBVM */
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -288,9 +332,15 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#else
+		/* pages are read in when first touched */
+		result = map_segment(as, v, ph.p_offset, ph.p_vaddr,
+				     ph.p_memsz, ph.p_filesz);
+#endif
 		if (result) {
 			return result;
 		}
@@ -48,6 +48,9 @@
 #include <openfile.h>
 #include <filetable.h>
 #include <syscall.h>
+#include <pagecache.h>
+#include <addrspace.h>
+#include "opt-dumbvm.h"
 
 /*
  * Note: if you are receiving this code as a patch to integrate with
@@ -387,6 +390,15 @@ sys_fsync(int fd)
 	 * and we're not using any of its non-constant fields.
 	 */
 
+#if !OPT_DUMBVM
+	/* what was written through our mappings of it goes first */
+	err = as_sync(proc_getas(), file->of_vnode);
+	if (err) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return err;
+	}
+#endif
+
 	err = VOP_FSYNC(file->of_vnode);
 	filetable_put(curproc->p_filetable, fd, file);
 	return err;
@@ -424,6 +436,9 @@ sys_ftruncate(int fd, off_t len)
 	 */
 
 	err = VOP_TRUNCATE(file->of_vnode, len);
+#if !OPT_DUMBVM
+	pagecache_invalidate(file->of_vnode);
+#endif
 	filetable_put(curproc->p_filetable, fd, file);
 	return err;
 }
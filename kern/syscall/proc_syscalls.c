@@ -37,6 +37,7 @@
 #include <lib.h>
 #include <machine/trapframe.h>
 #include <clock.h>
+#include <synch.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
@@ -74,7 +75,7 @@ sys__exit(int status)
 }
 
 /*
- * sys_fork
+ * sys_fork, sys_vfork
  *
  * create a new process, which begins executing in fork_newthread().
  */
@@ -100,8 +101,9 @@ fork_newthread(void *vtf, unsigned long junk)
 	enter_forked_process(&mytf);
 }
 
+static
 int
-sys_fork(struct trapframe *tf, pid_t *retval)
+fork_common(struct trapframe *tf, struct semaphore *vforksem, pid_t *retval)
 {
 	struct trapframe *ntf;
 	int result;
@@ -119,7 +121,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	}
 	*ntf = *tf;
 
-	result = proc_fork(&newproc);
+	result = proc_fork(vforksem, &newproc);
 	if (result) {
 		kfree(ntf);
 		return result;
@@ -137,6 +139,36 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+int
+sys_fork(struct trapframe *tf, pid_t *retval)
+{
+	return fork_common(tf, NULL, retval);
+}
+
+/*
+ * vfork: the child runs in our address space instead of a copy of it,
+ * so we sleep until it has execed or exited and no longer uses it.
+ * (Nothing is copied, which makes fork-then-exec much cheaper.)
+ */
+int
+sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+	struct semaphore *sem;
+	int result;
+
+	sem = sem_create("vfork", 0);
+	if (sem == NULL) {
+		return ENOMEM;
+	}
+
+	result = fork_common(tf, sem, retval);
+	if (result == 0) {
+		P(sem);
+	}
+	sem_destroy(sem);
+	return result;
+}
+
 /*
  * sys_waitpid
  * just pass off the work to the pid code.
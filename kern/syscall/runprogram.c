@@ -386,12 +386,13 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
         }
 
 	/*
-	 * Wipe out old address space.
+	 * Wipe out old address space, or give it back to our parent if
+	 * we borrowed it with vfork.
 	 *
 	 * Note: once this is done, execv() must not fail, because there's
 	 * nothing left for it to return an error to.
 	 */
-	if (oldvm) {
+	if (oldvm && !proc_vforkdone(curproc)) {
 		as_destroy(oldvm);
 	}
 
@@ -0,0 +1,159 @@
+/*
+ * Memory management system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+/*
+ * sbrk: move the end of the heap, and return where it used to be.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as = proc_getas();
+
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_sbrk(as, amount, retval);
+}
+
+/*
+ * mmap: map LENGTH bytes of the file FD from OFFSET on, or anonymous
+ * memory if FD is -1, and return where. Writes to a file mapping go
+ * back to the file, so the file must be open for reading, and for
+ * writing too if the mapping is writeable.
+ */
+int
+sys_mmap(size_t length, int prot, int fd, off_t offset, vaddr_t *retval)
+{
+	struct addrspace *as = proc_getas();
+	struct openfile *file;
+	int err;
+
+	if (as == NULL) {
+		return EFAULT;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE)) != 0) {
+		return EINVAL;
+	}
+
+	if (fd == -1) {
+		return as_mmap(as, length, prot, NULL, 0, retval);
+	}
+
+	err = filetable_get(curproc->p_filetable, fd, &file);
+	if (err) {
+		return err;
+	}
+
+	if (file->of_accmode == O_WRONLY ||
+	    ((prot & PROT_WRITE) && file->of_accmode != O_RDWR)) {
+		err = EACCES;
+	}
+	else {
+		/* not every kind of file can be mapped */
+		err = VOP_MMAP(file->of_vnode);
+	}
+	if (err == 0) {
+		err = as_mmap(as, length, prot, file->of_vnode, offset, retval);
+	}
+
+	filetable_put(curproc->p_filetable, fd, file);
+	return err;
+}
+
+/*
+ * munmap: remove the mapping starting at ADDR.
+ */
+int
+sys_munmap(userptr_t addr)
+{
+	struct addrspace *as = proc_getas();
+
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_munmap(as, (vaddr_t)addr);
+}
+
+/*
+ * mprotect: change the protection of LEN bytes of pages from ADDR on.
+ */
+int
+sys_mprotect(userptr_t addr, size_t len, int prot)
+{
+	struct addrspace *as = proc_getas();
+
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_mprotect(as, (vaddr_t)addr, len, prot);
+}
+
+/*
+ * madvise: say how LEN bytes of pages from ADDR on will be used.
+ */
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+	struct addrspace *as = proc_getas();
+
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_madvise(as, (vaddr_t)addr, len, advice);
+}
+
+/*
+ * mincore: for each page of the LEN bytes from ADDR on, set a byte of
+ * VEC to 1 if the page is resident and 0 if not.
+ */
+int
+sys_mincore(userptr_t addr, size_t len, userptr_t vec)
+{
+	struct addrspace *as = proc_getas();
+	unsigned char buf[128];
+	vaddr_t vaddr = (vaddr_t)addr;
+	unsigned npages, n;
+	int err;
+
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	/* the range must lie in user space, which also keeps it from wrapping */
+	if (vaddr >= USERSPACETOP || len > USERSPACETOP - vaddr) {
+		return ENOMEM;
+	}
+
+	/* a chunk of pages at a time */
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	while (npages > 0) {
+		n = npages < sizeof(buf) ? npages : sizeof(buf);
+		err = as_mincore(as, vaddr, n, buf);
+		if (err) {
+			return err;
+		}
+		err = copyout(buf, vec, n);
+		if (err) {
+			return err;
+		}
+		vaddr += n * PAGE_SIZE;
+		vec += n;
+		npages -= n;
+	}
+	return 0;
+}
@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <vm.h> /* for PAGE_SIZE */
 #include <test.h>
 
@@ -379,3 +380,246 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5
+
+/*
+ * Frame allocator test. Allocate single pages with alloc_kpages()
+ * until physical memory runs out, then free them all again, and
+ * report how long each half took per page. Do it twice and make sure
+ * we get the same number of pages both times, so we know nothing
+ * leaked.
+ *
+ * The allocated pages are chained together through their first word,
+ * so the test needs no memory of its own. Run it with no user
+ * programs running, or it will page them all out.
+ */
+
+static
+unsigned long
+km5_nsper(const struct timespec *ts, unsigned count)
+{
+	unsigned long usecs;
+
+	usecs = ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+	if (count == 0) {
+		return 0;
+	}
+	if (usecs < 4000000) {
+		return usecs * 1000 / count;
+	}
+	return usecs / count * 1000;
+}
+
+static
+unsigned
+km5_pass(void)
+{
+	struct timespec before, after, duration;
+	vaddr_t *chain, page;
+	unsigned count, freed;
+
+	chain = NULL;
+	count = 0;
+
+	gettime(&before);
+	while ((page = alloc_kpages(1)) != 0) {
+		*(vaddr_t **)page = chain;
+		chain = (vaddr_t *)page;
+		count++;
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	kprintf("kmalloctest5: allocated %u pages (%uk) in %llu.%09lu seconds, "
+		"%lu ns per page\n", count, count * (PAGE_SIZE / 1024),
+		(unsigned long long) duration.tv_sec,
+		(unsigned long) duration.tv_nsec,
+		km5_nsper(&duration, count));
+
+	freed = 0;
+	gettime(&before);
+	while (chain != NULL) {
+		page = (vaddr_t)chain;
+		chain = *(vaddr_t **)chain;
+		free_kpages(page);
+		freed++;
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	kprintf("kmalloctest5: freed %u pages in %llu.%09lu seconds, "
+		"%lu ns per page\n", freed,
+		(unsigned long long) duration.tv_sec,
+		(unsigned long) duration.tv_nsec,
+		km5_nsper(&duration, freed));
+
+	KASSERT(freed == count);
+	return count;
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	unsigned first, second;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting frame allocator test...\n");
+#if OPT_DUMBVM && (! OPT_UNSW)
+	kprintf("(This test will not work with dumbvm)\n");
+	return 0;
+#endif
+
+	first = km5_pass();
+	second = km5_pass();
+	if (first == 0 || first != second) {
+		kprintf("kmalloctest5: got %u pages then %u pages\n",
+			first, second);
+		panic("kmalloctest5: failed.\n");
+	}
+
+	kprintf("kmalloctest5: passed\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// km6
+
+/*
+ * Buddy allocator test. Allocate blocks of assorted sizes until
+ * memory runs out, tagging every page, and check that each block is
+ * aligned to its size rounded up to a power of two and that no block
+ * overwrote another. Then free every other block, allocate again into
+ * the holes, and free everything. Afterwards the largest block we can
+ * get must be as large as before, so the freed blocks merged again;
+ * or at least half as large, as the idle loop may meanwhile have taken
+ * a frame out of it for the zero pool.
+ *
+ * Like km5, run it with no user programs running.
+ */
+
+#define KM6_MAXBLOCKS 1024
+
+static const unsigned km6_sizes[] = { 1, 2, 3, 5, 8, 13, 16, 31 };
+#define KM6_NSIZES (sizeof(km6_sizes) / sizeof(km6_sizes[0]))
+
+static vaddr_t km6_blocks[KM6_MAXBLOCKS];
+static unsigned km6_npages[KM6_MAXBLOCKS];
+
+// the largest power of two number of pages we can allocate
+static
+unsigned
+km6_largest(void)
+{
+	unsigned n;
+	vaddr_t block;
+
+	for (n = 2048; n > 1; n /= 2) {
+		block = alloc_kpages(n);
+		if (block != 0) {
+			free_kpages(block);
+			break;
+		}
+	}
+	return n;
+}
+
+static
+vaddr_t
+km6_tag(unsigned b, unsigned p)
+{
+	return (vaddr_t)b << 16 | p;
+}
+
+static
+void
+km6_alloc(unsigned b, unsigned npages)
+{
+	unsigned p, align;
+	vaddr_t block;
+
+	block = alloc_kpages(npages);
+	km6_blocks[b] = block;
+	km6_npages[b] = npages;
+	if (block == 0) {
+		return;
+	}
+
+	align = 1;
+	while (align < npages) {
+		align *= 2;
+	}
+	if (block % (align * PAGE_SIZE) != 0) {
+		panic("kmalloctest6: %u pages at 0x%lx not aligned to %u pages\n",
+		      npages, (unsigned long)block, align);
+	}
+	for (p = 0; p < npages; p++) {
+		*(vaddr_t *)(block + p * PAGE_SIZE) = km6_tag(b, p);
+	}
+}
+
+static
+void
+km6_free(unsigned b)
+{
+	unsigned p;
+	vaddr_t block = km6_blocks[b];
+
+	if (block == 0) {
+		return;
+	}
+	for (p = 0; p < km6_npages[b]; p++) {
+		if (*(vaddr_t *)(block + p * PAGE_SIZE) != km6_tag(b, p)) {
+			panic("kmalloctest6: block %u page %u overwritten\n",
+			      b, p);
+		}
+	}
+	free_kpages(block);
+	km6_blocks[b] = 0;
+}
+
+int
+kmalloctest6(int nargs, char **args)
+{
+	unsigned b, before, after, count = 0;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting buddy allocator test...\n");
+#if OPT_DUMBVM && (! OPT_UNSW)
+	kprintf("(This test will not work with dumbvm)\n");
+	return 0;
+#endif
+
+	before = km6_largest();
+
+	for (b = 0; b < KM6_MAXBLOCKS; b++) {
+		km6_alloc(b, km6_sizes[b % KM6_NSIZES]);
+		if (km6_blocks[b] != 0) {
+			count++;
+		}
+	}
+	for (b = 0; b < KM6_MAXBLOCKS; b += 2) {
+		km6_free(b);
+	}
+	for (b = 0; b < KM6_MAXBLOCKS; b += 2) {
+		km6_alloc(b, km6_sizes[(b / 2) % KM6_NSIZES]);
+	}
+	for (b = 0; b < KM6_MAXBLOCKS; b++) {
+		km6_free(b);
+	}
+
+	after = km6_largest();
+	kprintf("kmalloctest6: %u blocks, largest free block %u pages "
+		"before and %u after\n", count, before, after);
+	if (count == 0 || after < before / 2) {
+		panic("kmalloctest6: failed.\n");
+	}
+
+	kprintf("kmalloctest6: passed\n");
+	return 0;
+}
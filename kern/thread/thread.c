@@ -53,6 +53,7 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include "opt-unsw.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -182,6 +183,10 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_numframes = 0;
+	spinlock_init(&c->c_framelock);
+	c->c_asid = 0;
+	c->c_asidgen = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -647,6 +652,19 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_UNSW
+			if (frame_idle_zero()) {
+				/*
+				 * Zeroed a page with interrupts off; take
+				 * any that came in meanwhile, which may
+				 * have made a thread runnable, before
+				 * looking at the runqueue again.
+				 */
+				cpu_irqonoff();
+				spinlock_acquire(&curcpu->c_runqueue_lock);
+				continue;
+			}
+#endif
 			cpu_idle();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
@@ -1133,6 +1151,24 @@ ipi_broadcast(int code)
 	}
 }
 
+/*
+ * Return the number of CPUs.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Return CPU number NUMBER.
+ */
+struct cpu *
+cpu_get(unsigned number)
+{
+	return cpuarray_get(&allcpus, number);
+}
+
 /*
  * Send a TLB shootdown IPI to the specified CPU.
  */
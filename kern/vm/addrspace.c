@@ -27,16 +27,24 @@
  * SUCH DAMAGE.
  */
 
+#define ASINLINE
+
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <synch.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <swap.h>
+#include <uio.h>
+#include <vnode.h>
 
 #include <elf.h>
 /*
@@ -49,6 +57,27 @@
  *
  */
 
+/*
+ * All address spaces, for reporting, protected by as_list_lock.
+ * as_walk_cv is signalled when the last walker leaves an address space.
+ */
+static struct addrspace *as_list = NULL;
+static struct lock *as_list_lock;
+static struct cv *as_walk_cv;
+
+/* stack limit, in pages, for new address spaces */
+static unsigned as_stacklimit = USERSTACK_LIMIT;
+
+void
+as_bootstrap(void)
+{
+	as_list_lock = lock_create("as_list");
+	as_walk_cv = cv_create("as_walk");
+	if (as_list_lock == NULL || as_walk_cv == NULL) {
+		panic("as_bootstrap: out of memory\n");
+	}
+}
+
 struct addrspace *
 as_create(void)
 {
@@ -72,20 +101,65 @@ as_create(void)
 	for(int i = 0; i < 1024; i++){
 		as->pagetable[i] = NULL;
 	}
+	for (int i = 0; i < PT_MAPWORDS; i++) {
+		as->ptmap[i] = 0;
+	}
 
-	// next we want to set the list of regions as null
-	as->regions = NULL;
+	// next we want to start with no regions
+	regionarray_init(&as->regions);
+	as->lastregion = NULL;
 
 	// and finally we set the addresses for the stack and heap to their initial values
 	as->heap = 0;
+	as->heapregion = NULL;
+	as->heapbreak = 0;
 	as->stack = USERSTACK;
+	as->stackregion = NULL;
+	as->stacklimit = as_stacklimit * PAGE_SIZE;
+	as->aheadused = 0;
 
     // set the loadingbit to false
     as->loadingbit = 0;
 
+    // no ASID until the address space is first activated
+    as->asid = 0;
+    as->asid_gen = 0;
+    as->tlbcpus = 0;
+
+	// and put it on the list of address spaces for vmps
+	as->pid = 0;
+	as->walkers = 0;
+	lock_acquire(as_list_lock);
+	as->next = as_list;
+	as_list = as;
+	lock_release(as_list_lock);
+
 	return as;
 }
 
+/*
+ * Return the index of the first level 2 table of AS from I on, or 1024
+ * if there are no more.
+ */
+static int
+as_next_table(struct addrspace *as, int i)
+{
+	while (i < 1024) {
+		uint32_t bits = as->ptmap[i / 32] >> (i % 32);
+		if (bits == 0) {
+			// nothing more in this word of the map
+			i = (i / 32 + 1) * 32;
+			continue;
+		}
+		while ((bits & 1) == 0) {
+			bits >>= 1;
+			i++;
+		}
+		return i;
+	}
+	return 1024;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -96,69 +170,138 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
-	// used to keep track of whether the frame is dirty or not
-	uint32_t isDirty = 0;
+	// share all entries in the page table that are in use, going only
+	// through the level 2 tables there are
+	for (int i = as_next_table(old, 0); i < 1024; i = as_next_table(old, i + 1)) {
+		paddr_t *src = old->pagetable[i];
 
-	// copy all entries in the page table that are not null
-	for(int i = 0; i < 1024; i++){
-		if(old->pagetable[i]){
-            // malloc the level 1 page table entry
-			newas->pagetable[i] = kmalloc(1024 * sizeof(paddr_t));
-            
-            // next copy all the level 2 entries associated
-			for(int j = 0; j < 1024; j++){
-                // test if the original entry has not been defined, if so just copy it to newas
-                if(old->pagetable[i][j] == 0){
-                    newas->pagetable[i][j] = old->pagetable[i][j];
-                } else {
-					// else allocate the page and copy the physical memory
-					vaddr_t copyFrame = alloc_kpages(1);
-					bzero((void *)copyFrame,PAGE_SIZE);
-					memmove((void *)copyFrame, (const void *)PADDR_TO_KVADDR(old->pagetable[i][j] & PAGE_FRAME), PAGE_SIZE);
-                    isDirty = old->pagetable[i][j] & TLBLO_DIRTY;
-                	newas->pagetable[i][j] = (KVADDR_TO_PADDR(copyFrame) & PAGE_FRAME) | TLBLO_VALID | isDirty;
-                }
+		// malloc the level 2 table
+		paddr_t *dst = kmalloc(1024 * sizeof(paddr_t));
+		if (dst == NULL) {
+			as_destroy(newas);
+			return ENOMEM;
+		}
+
+		// next copy all the level 2 entries associated, up to the
+		// last one in use
+		unsigned left = old->ptcount[i];
+		int j;
+		for (j = 0; j < 1024 && left > 0; j++) {
+			if (src[j] != 0) {
+				left--;
+			}
 
+			// test if the original entry has nothing behind it, if so just copy it to newas
+			if (PTE_EMPTY(src[j])) {
+				dst[j] = src[j];
+			} else if (PTE_ZEROPAGE(src[j])) {
+				// the zero page is always read-only and never freed
+				dst[j] = src[j];
+			} else if (frame_pin_pte(&src[j])) {
+				// else share the frame copy-on-write: both entries lose
+				// write permission and the first write makes a private copy
+				paddr_t frame = src[j] & PAGE_FRAME;
+				frame_incref(frame);
+				src[j] &= ~TLBLO_DIRTY;
+				dst[j] = src[j];
+				frame_unpin(frame);
+			} else {
+				// the page is out on swap, so share the swap slot instead
+				swap_incref(PTE_SLOT(src[j]));
+				dst[j] = src[j];
 			}
+			// only the parent writes its file mappings back
+			dst[j] &= ~PTE_FDIRTY;
+		}
+		for (; j < 1024; j++) {
+			dst[j] = 0;
 		}
+
+		newas->pagetable[i] = dst;
+		newas->ptcount[i] = old->ptcount[i];
+		newas->ptmap[i / 32] |= PT_MAPBIT(i);
 	}
 
-	// loop through all regions, and copy them to newas
-	region *new_region = NULL;
-	region *curr_region = old->regions;
-	while (curr_region != NULL) {
+	// the TLB may still hold writeable entries for the pages we just
+	// shared, so stop using the parent's entries
+	vm_tlb_forget(old);
+
+	// loop through all regions, and copy them to newas (already sorted)
+	unsigned num = regionarray_num(&old->regions);
+	for (unsigned k = 0; k < num; k++) {
+		region *curr_region = regionarray_get(&old->regions, k);
 
 		// we then allocate memory for this new region
 		region *tmp = kmalloc(sizeof(region));
 		
 		// checking the kmalloc was successful
 		if (tmp == NULL) {
+			as_destroy(newas);
 			return ENOMEM;
 		}
 
 		// we then setup all of the values for this region
-		tmp->base = curr_region->base;
-		tmp->size = curr_region->size;
-		tmp->flags = curr_region->flags;
-		tmp->prevFlags = curr_region->prevFlags;
-		tmp->next = NULL;
-
-		// if this is the first in the list, we set new_region to equal it
-		if (new_region == NULL) {
-			newas->regions = tmp;
-			new_region = tmp;
-		} else {
-			// otherwise it is appended to the end of the list
-			new_region->next = tmp;
+		*tmp = *curr_region;
+
+		// The child's copy of a file mapping is private, as with
+		// MAP_PRIVATE: it starts out sharing the parent's pages, written
+		// or not, but what either process writes afterwards is its own,
+		// and only the parent's writes reach the file.
+		if (tmp->mmapped && tmp->vnode != NULL) {
+			tmp->forked = true;
 		}
 
-		curr_region = curr_region->next;
+		if (regionarray_add(&newas->regions, tmp, NULL)) {
+			kfree(tmp);
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		if (tmp->vnode != NULL) {
+			VOP_INCREF(tmp->vnode);
+		}
+		if (curr_region == old->heapregion) {
+			newas->heapregion = tmp;
+		}
+		if (curr_region == old->stackregion) {
+			newas->stackregion = tmp;
+		}
 	}
 
+	// and the heap and stack with them
+	newas->heap = old->heap;
+	newas->heapbreak = old->heapbreak;
+	newas->stack = old->stack;
+	newas->stacklimit = old->stacklimit;
+
 	*ret = newas;
 	return 0;
 }
 
+/*
+ * Free the frame or swap slot behind the page table entry PTE, and
+ * clear it. The caller must have dropped any TLB entry for it.
+ */
+static void
+as_free_page(paddr_t *pte)
+{
+	if (PTE_EMPTY(*pte) || PTE_ZEROPAGE(*pte)) {
+		*pte = 0;
+		return;
+	}
+
+	if (frame_pin_pte(pte)) {
+		// take the frame away from the pager before letting it go
+		paddr_t frame = *pte & PAGE_FRAME;
+		*pte = 0;
+		frame_setowner(frame, NULL, 0);
+		frame_unpin(frame);
+		free_kpages(PADDR_TO_KVADDR(frame));
+	} else {
+		swap_free(PTE_SLOT(*pte));
+		*pte = 0;
+	}
+}
+
 void
 as_destroy(struct addrspace *as)
 {
@@ -167,20 +310,38 @@ as_destroy(struct addrspace *as)
 		return;
 	}
 
-	// we first want to free all pages in the page table
-	for(int i = 0; i < 1024; i++){
+	// take it off the list first, so vmps won't look at it any more,
+	// once the page merger is done with it
+	lock_acquire(as_list_lock);
+	while (as->walkers > 0) {
+		cv_wait(as_walk_cv, as_list_lock);
+	}
+	struct addrspace **asp = &as_list;
+	while (*asp != as) {
+		KASSERT(*asp != NULL);
+		asp = &(*asp)->next;
+	}
+	*asp = as->next;
+	lock_release(as_list_lock);
 
-		// if the current value in the page table is already NULL,
-		// we can just continue
-		if (as->pagetable[i] == NULL) {
-			continue;
-		}
+	// what was written to file mappings goes back to the files; there
+	// is nobody left to tell if that fails
+	(void)as_sync(as, NULL);
 
-		// otherwise, we step down into the 2nd level page table
-		// and free all pages in this entry
-		for (int j = 0; j < 1024; j++) {
+	// make sure the TLB refill code no longer walks the page table
+	vm_tlb_deactivate(as);
+
+	// we first want to free all pages in the page table, going only
+	// through the level 2 tables there are
+	for (int i = as_next_table(as, 0); i < 1024; i = as_next_table(as, i + 1)) {
+
+		// we step down into the 2nd level page table and free all
+		// pages in this entry, up to the last one in use
+		unsigned left = as->ptcount[i];
+		for (int j = 0; j < 1024 && left > 0; j++) {
 			if (as->pagetable[i][j] != 0) {
-				free_kpages(PADDR_TO_KVADDR(as->pagetable[i][j] & PAGE_FRAME));
+				as_free_page(&as->pagetable[i][j]);
+				left--;
 			}
 		}
 
@@ -192,23 +353,25 @@ as_destroy(struct addrspace *as)
 	// once all pagetables entries are freed, we free the pagetable itself
 	kfree(as->pagetable);
 
-	// then we free all regions in the linked list
-	region *tmp;
-	while (as->regions != NULL) {
-		tmp = as->regions;
-		as->regions = as->regions->next;
+	// then we free all regions
+	unsigned num = regionarray_num(&as->regions);
+	for (unsigned k = 0; k < num; k++) {
+		region *tmp = regionarray_get(&as->regions, k);
+		if (tmp->vnode != NULL) {
+			VOP_DECREF(tmp->vnode);
+		}
 		kfree(tmp);
 	}
+	regionarray_setsize(&as->regions, 0);
+	regionarray_cleanup(&as->regions);
 
 	// finally we free the address space itself
 	kfree(as);
 }
 
-// copied from dumbvm.c
 void
 as_activate(void)
 {
-	int i, spl;
 	struct addrspace *as;
 
 	as = proc_getas();
@@ -216,14 +379,9 @@ as_activate(void)
 		return;
 	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
-
-	splx(spl);
+	// switch to the address space's ASID, the TLB is only flushed
+	// when ASIDs run out
+	vm_tlb_activate(as);
 }
 
 // copied from dumbvm.c
@@ -233,6 +391,145 @@ as_deactivate(void)
 	/* nothing */
 }
 
+/*
+ * Return the index of the first region with a base above VADDR, by
+ * binary search; the region containing VADDR, if any, is the one
+ * before it.
+ */
+static unsigned
+as_region_index(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo = 0, hi = regionarray_num(&as->regions);
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (regionarray_get(&as->regions, mid)->base <= vaddr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Put region R into the array at index POS.
+ */
+static int
+as_insert_region(struct addrspace *as, unsigned pos, region *r)
+{
+	unsigned num = regionarray_num(&as->regions);
+
+	if (regionarray_setsize(&as->regions, num + 1)) {
+		return ENOMEM;
+	}
+	for (unsigned k = num; k > pos; k--) {
+		regionarray_set(&as->regions, k, regionarray_get(&as->regions, k - 1));
+	}
+	regionarray_set(&as->regions, pos, r);
+	return 0;
+}
+
+/*
+ * Take region R out of the array and free it. Its pages must already
+ * be gone.
+ */
+static void
+as_remove_region(struct addrspace *as, region *r)
+{
+	unsigned num = regionarray_num(&as->regions);
+	unsigned pos = as_region_index(as, r->base) - 1;
+
+	KASSERT(regionarray_get(&as->regions, pos) == r);
+	for (unsigned k = pos; k + 1 < num; k++) {
+		regionarray_set(&as->regions, k, regionarray_get(&as->regions, k + 1));
+	}
+	regionarray_setsize(&as->regions, num - 1);
+	as->lastregion = NULL;
+
+	if (r->vnode != NULL) {
+		VOP_DECREF(r->vnode);
+	}
+	kfree(r);
+}
+
+/*
+ * Find the region containing VADDR. Faults tend to come in runs in
+ * the same region, so the last region found is checked first.
+ */
+region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	region *r = as->lastregion;
+
+	if (r != NULL && r->base <= vaddr && vaddr < r->base + r->size) {
+		return r;
+	}
+
+	unsigned pos = as_region_index(as, vaddr);
+	if (pos == 0) {
+		return NULL;
+	}
+	r = regionarray_get(&as->regions, pos - 1);
+	if (vaddr >= r->base + r->size) {
+		return NULL;
+	}
+
+	as->lastregion = r;
+	return r;
+}
+
+/*
+ * Give the page at VADDR, the first or last page of region R, to a
+ * second segment of the executable as well. The page becomes a region
+ * of its own with the permissions of both segments, and since it
+ * holds data from two places in the file it is read in at load time
+ * instead of on demand (see as_define_file).
+ */
+static int
+as_share_page(struct addrspace *as, region *r, vaddr_t vaddr, uint32_t flags)
+{
+	// only segments of the executable can share, and they are all
+	// defined before any of them is backed by the file
+	if (r->vnode != NULL) {
+		return EINVAL;
+	}
+	KASSERT(vaddr == r->base || vaddr == r->base + r->size - PAGE_SIZE);
+
+	if (r->size > PAGE_SIZE) {
+		region *page = kmalloc(sizeof(region));
+		if (page == NULL) {
+			return ENOMEM;
+		}
+		*page = *r;
+		page->base = vaddr;
+		page->size = PAGE_SIZE;
+		page->filebase = vaddr;
+
+		if (vaddr == r->base) {
+			r->base += PAGE_SIZE;
+			r->filebase = r->base;
+		}
+		r->size -= PAGE_SIZE;
+		if (as_insert_region(as, as_region_index(as, vaddr), page)) {
+			if (vaddr < r->base) {
+				r->base -= PAGE_SIZE;
+				r->filebase = r->base;
+			}
+			r->size += PAGE_SIZE;
+			kfree(page);
+			return ENOMEM;
+		}
+		r = page;
+	}
+
+	r->flags |= flags;
+	r->prevFlags = r->flags;
+	r->loadshared = true;
+	as->lastregion = NULL;
+	return 0;
+}
+
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
@@ -254,8 +551,8 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	}
 
 	// by adding the memsize to the vaddr, we can see if the end of the region
-	// goes into the stack. if it does, we are out of memory so return ENOMEM
-	if (vaddr + memsize >= as->stack) {
+	// goes past the stack. if it does, we are out of memory so return ENOMEM
+	if (vaddr + memsize > as->stack || vaddr + memsize < vaddr) {
 		return ENOMEM;
 	}
 
@@ -264,6 +561,62 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	vaddr &= PAGE_FRAME;
 	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
 
+	// work out the flags for this region based on whether it is
+	// readable, writeable or executable
+	uint32_t flags = 0;
+	if (readable) {
+		flags |= PF_R;
+	}
+	if (writeable) {
+		flags |= PF_W;
+	}
+	if (executable) {
+		flags |= PF_X;
+	}
+
+	// find where the region goes in the sorted array, and make sure it
+	// does not overlap its neighbours. The one exception is a segment
+	// of the executable that starts in the page the one before it ends
+	// in, or ends in the page the next one starts in
+	int result;
+	bool shared = false;
+	unsigned pos = as_region_index(as, vaddr);
+	if (pos > 0) {
+		region *prev = regionarray_get(&as->regions, pos - 1);
+		if (prev->base + prev->size > vaddr) {
+			if (memsize == 0 ||
+			    prev->base + prev->size != vaddr + PAGE_SIZE) {
+				return EINVAL;
+			}
+			result = as_share_page(as, prev, vaddr, flags);
+			if (result) {
+				return result;
+			}
+			vaddr += PAGE_SIZE;
+			memsize -= PAGE_SIZE;
+			shared = true;
+			pos = as_region_index(as, vaddr);
+		}
+	}
+	if (pos < regionarray_num(&as->regions) && memsize > 0) {
+		region *next = regionarray_get(&as->regions, pos);
+		if (next->base < vaddr + memsize) {
+			if (next->base != vaddr + memsize - PAGE_SIZE) {
+				return EINVAL;
+			}
+			result = as_share_page(as, next, next->base, flags);
+			if (result) {
+				return result;
+			}
+			memsize -= PAGE_SIZE;
+			shared = true;
+		}
+	}
+	if (shared && memsize == 0) {
+		// the whole segment lies in pages it shares
+		return 0;
+	}
+
 	// we then allocate memory for this new region
 	region *newRegion = kmalloc(sizeof(region));
 	
@@ -276,36 +629,144 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	// passed in through the function
 	newRegion->base = vaddr;
 	newRegion->size = memsize;
-
-	// we also want to assign the flags for this region based
-	// on whether it is readable, writeable or executable
-	newRegion->flags = 0;
-	if (readable) {
-		newRegion->flags |= PF_R;
-	}
-	if (writeable) {
-		newRegion->flags |= PF_W;
-	}
-	if (executable) {
-		newRegion->flags |= PF_X;
-	}
+	newRegion->flags = flags;
 
 	// we also want to set the prevFlags to equal the same
 	newRegion->prevFlags = newRegion->flags;
 
+	// the region is anonymous memory until as_define_file says otherwise
+	newRegion->vnode = NULL;
+	newRegion->filebase = vaddr;
+	newRegion->offset = 0;
+	newRegion->filesize = 0;
+	newRegion->mmapped = false;
+	newRegion->forked = false;
+	newRegion->loadshared = false;
+	newRegion->advice = MADV_NORMAL;
+
 	// now that we have finished setting up the new region,
-	// we can add it to the head of the linked list of regions
-	newRegion->next = as->regions;
-	as->regions = newRegion;
+	// we can insert it into the array of regions at pos
+	if (as_insert_region(as, pos, newRegion)) {
+		kfree(newRegion);
+		return ENOMEM;
+	}
 
-	// finally we update the address for the heap,
-	// which sits above the last region
-	as->heap = vaddr + memsize;
+	// finally we update the address for the heap, which sits above
+	// the highest region of the executable
+	if (as->heapregion == NULL && as->heap < vaddr + memsize) {
+		as->heap = vaddr + memsize;
+	}
 
 	return 0;
 
 }
 
+/*
+ * Read FILESIZE bytes of the file V at offset OFFSET into the user
+ * pages at VADDR now, for a page shared by two segments.
+ */
+static int
+as_read_now(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+	    off_t offset, size_t filesize)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	iov.iov_ubase = (userptr_t)vaddr;
+	iov.iov_len = filesize;
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_resid = filesize;
+	u.uio_offset = offset;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = as;
+
+	result = VOP_READ(v, &u);
+	if (result) {
+		return result;
+	}
+	return u.uio_resid == 0 ? 0 : ENOEXEC;
+}
+
+/*
+ * Back the region containing VADDR with FILESIZE bytes of the file V,
+ * starting at file offset OFFSET and mapped at VADDR. Nothing is read
+ * now: vm_fault() reads each page in from the file when it is first
+ * touched, and zero fills whatever lies outside the file data. The
+ * exception is data in a page shared with another segment (see
+ * as_share_page), which is read in straight away.
+ */
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+	       off_t offset, size_t filesize)
+{
+	int result;
+
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	// find the region the file data goes in
+	region *curr_region = as_find_region(as, vaddr);
+	if (curr_region == NULL) {
+		return EFAULT;
+	}
+
+	// the segment may start in a page it shares with the one before
+	if (curr_region->loadshared) {
+		size_t len = curr_region->base + curr_region->size - vaddr;
+		if (len > filesize) {
+			len = filesize;
+		}
+		result = as_read_now(as, vaddr, v, offset, len);
+		if (result) {
+			return result;
+		}
+		vaddr += len;
+		offset += len;
+		filesize -= len;
+		if (filesize == 0) {
+			return 0;
+		}
+		curr_region = as_find_region(as, vaddr);
+		if (curr_region == NULL || curr_region->loadshared) {
+			return EFAULT;
+		}
+	}
+
+	// and end in a page it shares with the one after
+	size_t len = curr_region->base + curr_region->size - vaddr;
+	if (filesize > len) {
+		region *tail = as_find_region(as, vaddr + len);
+		if (tail == NULL || !tail->loadshared ||
+		    filesize - len > tail->size) {
+			return EFAULT;
+		}
+		result = as_read_now(as, vaddr + len, v, offset + len,
+				     filesize - len);
+		if (result) {
+			return result;
+		}
+		filesize = len;
+	}
+
+	// a region can only be backed by one piece of one file
+	if (curr_region->vnode != NULL) {
+		return EINVAL;
+	}
+
+	VOP_INCREF(v);
+	curr_region->vnode = v;
+	curr_region->filebase = vaddr;
+	curr_region->offset = offset;
+	curr_region->filesize = filesize;
+
+	return 0;
+}
+
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -331,16 +792,20 @@ as_complete_load(struct addrspace *as)
 	// reset the loading bit
 	as->loadingbit = 0;
 
-    // flush the TLB since it will have outdated flags
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	int i, spl;
-	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	// the heap starts out empty, above everything just loaded
+	if (as->heapregion == NULL) {
+		int result = as_define_region(as, as->heap, 0, 1, 1, 0);
+		if (result) {
+			return result;
+		}
+		as->heapregion = regionarray_get(&as->regions,
+						 regionarray_num(&as->regions) - 1);
+		KASSERT(as->heapregion->base == as->heap);
+		as->heapbreak = as->heap;
 	}
 
-	splx(spl);
+    // drop the TLB entries since they will have outdated flags
+	vm_tlb_forget(as);
 
 	return 0;
 }
@@ -348,14 +813,726 @@ as_complete_load(struct addrspace *as)
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
-	(void)as;
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	// the stack starts out as one page, and grows as it faults
+	int result = as_define_region(as, as->stack - PAGE_SIZE, PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+	as->stackregion = as_find_region(as, as->stack - PAGE_SIZE);
 
 	/* Initial user-level stack pointer */
-	*stackptr = USERSTACK;
+	*stackptr = as->stack;
+
+	return 0;
+}
+
+/*
+ * Lowest address anything other than the stack may use: the stack
+ * limit plus the guard gap is kept clear below the top of the stack.
+ */
+static vaddr_t
+as_stack_floor(struct addrspace *as)
+{
+	return as->stack - as->stacklimit - USERSTACK_GUARD * PAGE_SIZE;
+}
+
+/*
+ * A fault at VADDR just below the stack grows the stack down to cover
+ * it, as long as the stack stays within its limit and keeps the guard
+ * gap clear above the heap and whatever else is below it.
+ */
+region *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	region *r = as->stackregion;
+
+	if (r == NULL || vaddr >= r->base || vaddr < as->stack - as->stacklimit) {
+		return NULL;
+	}
+
+	vaddr_t newbase = vaddr & PAGE_FRAME;
+	vaddr_t guard = USERSTACK_GUARD * PAGE_SIZE;
+
+	// the heap can move, so check against it explicitly
+	if (newbase < guard || newbase - guard < as->heapbreak) {
+		return NULL;
+	}
+
+	// and against the region below
+	unsigned pos = as_region_index(as, r->base) - 1;
+	KASSERT(regionarray_get(&as->regions, pos) == r);
+	if (pos > 0) {
+		region *below = regionarray_get(&as->regions, pos - 1);
+		if (newbase - guard < below->base + below->size) {
+			return NULL;
+		}
+	}
+
+	r->size += r->base - newbase;
+	r->base = newbase;
+	return r;
+}
+
+int
+as_set_stacklimit(unsigned npages)
+{
+	vaddr_t max = (USERSTACK - MIPS_KUSEG) / PAGE_SIZE / 2;
+
+	if (npages == 0 || npages > max) {
+		return EINVAL;
+	}
+	as_stacklimit = npages;
+	return 0;
+}
+
+/*
+ * Free level 2 table I of AS, which has no entries in use. vmps or the
+ * page merger may be walking it, hence as_list_lock and waiting for
+ * walkers; the TLB refill fast path only walks the page table of the
+ * address space running here, which is AS.
+ */
+static void
+as_free_table(struct addrspace *as, int i)
+{
+	paddr_t *l2 = as->pagetable[i];
+
+	KASSERT(as->ptcount[i] == 0);
+
+	lock_acquire(as_list_lock);
+	while (as->walkers > 0) {
+		cv_wait(as_walk_cv, as_list_lock);
+	}
+	as->pagetable[i] = NULL;
+	as->ptmap[i / 32] &= ~PT_MAPBIT(i);
+	lock_release(as_list_lock);
+
+	kfree(l2);
+}
+
+/*
+ * Free the pages from START up to END (both page aligned), and drop
+ * their TLB entries. The regions they are in stay defined, so the
+ * pages fault back in zero filled (or from the executable). Level 2
+ * tables left with nothing in them are freed too.
+ */
+void
+as_unmap(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	KASSERT((start & ~PAGE_FRAME) == 0 && (end & ~PAGE_FRAME) == 0);
+
+	for (vaddr_t page = start; page < end; page += PAGE_SIZE) {
+		paddr_t *l2 = as->pagetable[PT_LVL1(page)];
+		if (l2 == NULL) {
+			// skip the rest of this level 2 table
+			page |= (1 << 22) - PAGE_SIZE;
+			if (page + PAGE_SIZE == 0) {
+				break;
+			}
+			continue;
+		}
+		if (l2[PT_LVL2(page)] != 0) {
+			vm_tlb_invalidate(as, page);
+			as_free_page(&l2[PT_LVL2(page)]);
+			if (--as->ptcount[PT_LVL1(page)] == 0) {
+				as_free_table(as, PT_LVL1(page));
+			}
+		}
+	}
+}
+
+/*
+ * Move the end of the heap by AMOUNT bytes and hand back where it
+ * was. The heap may grow up to the stack, and shrink back to where it
+ * started; whole pages it shrinks away from are given back straight
+ * away.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+	if (as->heapregion == NULL) {
+		return ENOMEM;
+	}
+
+	vaddr_t oldend = as->heapbreak;
+	vaddr_t newend = oldend + amount;
+
+	if (amount < 0) {
+		// can't shrink below the start of the heap (or wrap), or
+		// into a part of it mprotect has split off
+		if (newend > oldend || newend < as->heapregion->base) {
+			return EINVAL;
+		}
+	} else {
+		// and can't grow into the space kept for the stack (or
+		// wrap), or past what memory and swap together could ever hold
+		if (newend < oldend ||
+		    newend > as_stack_floor(as) ||
+		    (newend - as->heap) / PAGE_SIZE > frame_count() + swap_size()) {
+			return ENOMEM;
+		}
+	}
+
+	// the region covers the break rounded up to a page
+	region *r = as->heapregion;
+	vaddr_t oldtop = r->base + r->size;
+	vaddr_t newtop = (newend + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	if (newtop > oldtop) {
+		// and can't grow into another region (one can start right at
+		// the heap while it is empty, so look from the heap's base)
+		unsigned num = regionarray_num(&as->regions);
+		for (unsigned k = as_region_index(as, r->base - 1); k < num; k++) {
+			region *next = regionarray_get(&as->regions, k);
+			if (next->base >= newtop) {
+				break;
+			}
+			if (next != r) {
+				return ENOMEM;
+			}
+		}
+	}
+
+	r->size = newtop - r->base;
+	if (newtop < oldtop) {
+		as_unmap(as, newtop, oldtop);
+	}
+
+	as->heapbreak = newend;
+	*oldbreak = oldend;
+	return 0;
+}
+
+/*
+ * Find room for NPAGES pages between the heap and the stack, as high
+ * up as possible so the heap has room to grow.
+ */
+static int
+as_find_gap(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+	vaddr_t size = npages * PAGE_SIZE;
+	vaddr_t top = as_stack_floor(as);
 
+	if (npages == 0 || npages > top / PAGE_SIZE) {
+		return ENOMEM;
+	}
+
+	// walk down from the stack, looking below each region in turn
+	// (page 0 is never mapped)
+	vaddr_t bottom = PAGE_SIZE;
+	for (unsigned k = regionarray_num(&as->regions); k > 0; k--) {
+		region *r = regionarray_get(&as->regions, k - 1);
+		vaddr_t end = r->base + r->size;
+
+		if (end <= top && top - end >= size) {
+			bottom = end;
+			break;
+		}
+		if (r->base < top) {
+			top = r->base;
+		}
+	}
+
+	if (top < bottom || top - bottom < size) {
+		return ENOMEM;
+	}
+	*ret = top - size;
 	return 0;
 }
 
+/*
+ * Map LENGTH bytes at an unused address: the file V from OFFSET on,
+ * or anonymous zero filled memory if V is NULL. Like the executable,
+ * the file is read a page at a time as pages are touched; unlike it,
+ * what is written goes back to the file on munmap, fsync or exit.
+ * Whatever lies past the end of the file reads as zeros.
+ */
+int
+as_mmap(struct addrspace *as, size_t length, int prot, struct vnode *v,
+	off_t offset, vaddr_t *ret)
+{
+	struct stat st;
+	size_t filesize = 0;
+	vaddr_t vaddr;
+	int result;
+
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+	if (length == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+
+	if (v != NULL) {
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
+		if (offset < st.st_size) {
+			filesize = st.st_size - offset;
+			if (filesize > length) {
+				filesize = length;
+			}
+		}
+	}
+
+	result = as_find_gap(as, (length + PAGE_SIZE - 1) / PAGE_SIZE, &vaddr);
+	if (result) {
+		return result;
+	}
+	result = as_define_region(as, vaddr, length, prot & PROT_READ,
+				  prot & PROT_WRITE, 0);
+	if (result) {
+		return result;
+	}
+
+	region *r = as_find_region(as, vaddr);
+	KASSERT(r != NULL && r->base == vaddr);
+	r->mmapped = true;
+	if (v != NULL) {
+		VOP_INCREF(v);
+		r->vnode = v;
+		r->offset = offset;
+		r->filesize = filesize;
+	}
+
+	*ret = vaddr;
+	return 0;
+}
+
+/*
+ * Write back what was written to the file mapping R.
+ */
+static int
+as_sync_region(struct addrspace *as, region *r)
+{
+	int result, err = 0;
+
+	for (vaddr_t page = r->base; page < r->base + r->size; page += PAGE_SIZE) {
+		result = vm_writeback(as, r, page);
+		if (result && err == 0) {
+			// carry on with the other pages, and report the first error
+			err = result;
+		}
+	}
+	return err;
+}
+
+int
+as_sync(struct addrspace *as, struct vnode *v)
+{
+	int result, err = 0;
+
+	unsigned num = regionarray_num(&as->regions);
+	for (unsigned k = 0; k < num; k++) {
+		region *r = regionarray_get(&as->regions, k);
+		if (!r->mmapped || r->vnode == NULL || r->forked) {
+			continue;
+		}
+		if (v != NULL && r->vnode != v) {
+			continue;
+		}
+		result = as_sync_region(as, r);
+		if (result && err == 0) {
+			err = result;
+		}
+	}
+	return err;
+}
+
+/*
+ * Remove the mapping that starts at VADDR. mprotect may have split it
+ * into several regions; they all keep the address the mapping started
+ * at as their filebase. Written pages go back to the file first; if
+ * that fails the whole mapping stays, so nothing is lost and the
+ * caller can try again.
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr)
+{
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	region *r = as_find_region(as, vaddr);
+	if (r == NULL || !r->mmapped || r->base != vaddr || r->filebase != vaddr) {
+		return EINVAL;
+	}
+
+	// write every piece back before removing any, so that a failure
+	// leaves the whole mapping in place
+	region *first = r;
+	while (r != NULL && r->mmapped && r->filebase == vaddr) {
+		if (r->vnode != NULL) {
+			int result = as_sync_region(as, r);
+			if (result) {
+				return result;
+			}
+		}
+		r = as_find_region(as, r->base + r->size);
+	}
+
+	r = first;
+	while (r != NULL && r->mmapped && r->filebase == vaddr) {
+		vaddr_t end = r->base + r->size;
+
+		as_unmap(as, r->base, end);
+		as_remove_region(as, r);
+
+		r = as_find_region(as, end);
+	}
+
+	return 0;
+}
+
+/*
+ * Split the region containing VADDR in two at VADDR, if VADDR is
+ * inside it. The pieces keep the same file backing, which is given by
+ * address and so still lines up. The top piece of the heap stays the
+ * heap.
+ */
+static int
+as_split_region(struct addrspace *as, vaddr_t vaddr)
+{
+	region *r = as_find_region(as, vaddr);
+	if (r == NULL || r->base == vaddr) {
+		return 0;
+	}
+
+	region *top = kmalloc(sizeof(region));
+	if (top == NULL) {
+		return ENOMEM;
+	}
+	*top = *r;
+	top->base = vaddr;
+	top->size = r->base + r->size - vaddr;
+
+	// it goes just after r, before anything starting at vaddr or above
+	if (as_insert_region(as, as_region_index(as, vaddr - 1), top)) {
+		kfree(top);
+		return ENOMEM;
+	}
+	r->size = vaddr - r->base;
+	if (top->vnode != NULL) {
+		VOP_INCREF(top->vnode);
+	}
+	if (r == as->heapregion) {
+		as->heapregion = top;
+	}
+
+	return 0;
+}
+
+/*
+ * Check that the pages from START up to END are all in regions, and
+ * split regions so none straddles START or END if SPLIT is set.
+ * Returns ENOMEM for a hole, like mprotect and madvise should.
+ */
+static int
+as_check_range(struct addrspace *as, vaddr_t start, vaddr_t end, bool split)
+{
+	for (vaddr_t addr = start; addr < end; ) {
+		region *r = as_find_region(as, addr);
+		if (r == NULL) {
+			return ENOMEM;
+		}
+		addr = r->base + r->size;
+	}
+
+	if (split) {
+		int result = as_split_region(as, start);
+		if (result) {
+			return result;
+		}
+		return as_split_region(as, end);
+	}
+	return 0;
+}
+
+// page align a range from user space, checking it doesn't wrap
+static int
+as_user_range(vaddr_t vaddr, size_t len, vaddr_t *end)
+{
+	if ((vaddr & ~PAGE_FRAME) != 0) {
+		return EINVAL;
+	}
+	*end = (vaddr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (*end < vaddr || (len > 0 && *end == vaddr)) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Change the protection of the pages from VADDR to VADDR + LEN to
+ * PROT. The regions change, and the page table and the TLB follow
+ * straight away: pages that may no longer be written lose their
+ * writeable entries, and pages that may not be touched at all are
+ * left for vm_fault() to refuse. Pages that gain permissions pick
+ * them up on their next fault.
+ */
+int
+as_mprotect(struct addrspace *as, vaddr_t vaddr, size_t len, int prot)
+{
+	vaddr_t end;
+	int result;
+
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE)) != 0) {
+		return EINVAL;
+	}
+	result = as_user_range(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+	result = as_check_range(as, vaddr, end, true);
+	if (result) {
+		return result;
+	}
+
+	for (vaddr_t addr = vaddr; addr < end; ) {
+		region *r = as_find_region(as, addr);
+		KASSERT(r != NULL && r->base >= vaddr && r->base + r->size <= end);
+
+		r->flags &= ~(PF_R | PF_W);
+		if (prot & PROT_READ) {
+			r->flags |= PF_R;
+		}
+		if (prot & PROT_WRITE) {
+			r->flags |= PF_W;
+		}
+		r->prevFlags = r->flags;
+		addr = r->base + r->size;
+	}
+
+	if (prot & PROT_WRITE) {
+		return 0;
+	}
+
+	for (vaddr_t page = vaddr; page < end; page += PAGE_SIZE) {
+		paddr_t *l2 = as->pagetable[PT_LVL1(page)];
+		if (l2 == NULL) {
+			continue;
+		}
+		// keep the pager and page merger off the entry while we
+		// change it
+		paddr_t *pte = &l2[PT_LVL2(page)];
+		if (!frame_pin_pte(pte)) {
+			continue;
+		}
+		if (prot == 0) {
+			// keep the refill fast path from loading it again
+			vm_tlb_trap(as, page);
+		} else {
+			*pte &= ~TLBLO_DIRTY;
+			vm_tlb_invalidate(as, page);
+		}
+		frame_unpin(*pte & PAGE_FRAME);
+	}
+
+	return 0;
+}
+
+/*
+ * Take advice about how the pages from VADDR to VADDR + LEN will be
+ * used. NORMAL, RANDOM and SEQUENTIAL are remembered by the regions
+ * and shape fault-around. WILLNEED reads the pages in now. DONTNEED
+ * frees them now: anonymous pages read back as zeros, and pages of
+ * files are written back if need be and read in again.
+ */
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len, int advice)
+{
+	vaddr_t end;
+	int result;
+
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+	result = as_user_range(vaddr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	switch (advice) {
+	case MADV_NORMAL:
+	case MADV_RANDOM:
+	case MADV_SEQUENTIAL:
+		result = as_check_range(as, vaddr, end, true);
+		if (result) {
+			return result;
+		}
+		for (vaddr_t addr = vaddr; addr < end; ) {
+			region *r = as_find_region(as, addr);
+			r->advice = advice;
+			addr = r->base + r->size;
+		}
+		return 0;
+
+	case MADV_WILLNEED:
+	case MADV_DONTNEED:
+		result = as_check_range(as, vaddr, end, false);
+		if (result) {
+			return result;
+		}
+		for (vaddr_t page = vaddr; page < end; page += PAGE_SIZE) {
+			region *r = as_find_region(as, page);
+
+			if (advice == MADV_WILLNEED) {
+				result = vm_prefault(as, r, page);
+			} else if (r->mmapped && r->vnode != NULL) {
+				result = vm_writeback(as, r, page);
+			}
+			if (result) {
+				return result;
+			}
+		}
+		if (advice == MADV_DONTNEED) {
+			as_unmap(as, vaddr, end);
+		}
+		return 0;
+
+	default:
+		return EINVAL;
+	}
+}
+
+/*
+ * Report which of the NPAGES pages from VADDR on are resident. Fails
+ * with ENOMEM if any of them is not mapped at all.
+ */
+int
+as_mincore(struct addrspace *as, vaddr_t vaddr, unsigned npages,
+	   unsigned char *vec)
+{
+	// if the address space is not valid, we return EFAULT for a bad memory reference
+	if (as == NULL) {
+		return EFAULT;
+	}
+	if ((vaddr & ~PAGE_FRAME) != 0) {
+		return EINVAL;
+	}
+
+	for (unsigned k = 0; k < npages; k++) {
+		vaddr_t page = vaddr + k * PAGE_SIZE;
+		if (page < vaddr || as_find_region(as, page) == NULL) {
+			return ENOMEM;
+		}
+
+		paddr_t *l2 = as->pagetable[PT_LVL1(page)];
+		vec[k] = (l2 != NULL && (l2[PT_LVL2(page)] & TLBLO_VALID)) ? 1 : 0;
+	}
+	return 0;
+}
+
+/*
+ * Count the pages of AS by walking its page table. Another process may
+ * be changing it meanwhile, so the counts are only a snapshot.
+ */
+void
+as_getstats(struct addrspace *as, struct as_stats *st)
+{
+	st->resident = 0;
+	st->swapped = 0;
+	st->shared = 0;
+	st->ptpages = 1;
+
+	for (int i = as_next_table(as, 0); i < 1024; i = as_next_table(as, i + 1)) {
+		paddr_t *l2 = as->pagetable[i];
+		st->ptpages++;
+
+		for (int j = 0; j < 1024; j++) {
+			paddr_t pte = l2[j];
+			if (pte & TLBLO_VALID) {
+				st->resident++;
+				if (PTE_ZEROPAGE(pte) ||
+				    frame_refcount(pte & PAGE_FRAME) > 1) {
+					st->shared++;
+				}
+			} else if (pte & PTE_SWAPPED) {
+				st->swapped++;
+			}
+		}
+	}
+}
+
+/*
+ * Call FN on every page table entry in use in every address space but
+ * those being loaded (for the page merger, ksm.c). The list lock is
+ * only held between address spaces; while FN runs, the walker count
+ * keeps the address space being walked and its level 2 tables from
+ * going away, so only that one waits for the walk.
+ */
+void
+as_walkall(void (*fn)(struct addrspace *, vaddr_t, paddr_t *, void *),
+	   void *data)
+{
+	lock_acquire(as_list_lock);
+	struct addrspace *as = as_list;
+	while (as != NULL) {
+		if (as->loadingbit) {
+			as = as->next;
+			continue;
+		}
+		as->walkers++;
+		lock_release(as_list_lock);
+
+		for (int i = as_next_table(as, 0); i < 1024; i = as_next_table(as, i + 1)) {
+			paddr_t *l2 = as->pagetable[i];
+			for (int j = 0; j < 1024; j++) {
+				if (l2[j] != 0) {
+					fn(as, ((vaddr_t)i << 22) | ((vaddr_t)j << 12),
+					   &l2[j], data);
+				}
+			}
+		}
+
+		// it is still on the list, so its successor is next
+		lock_acquire(as_list_lock);
+		as->walkers--;
+		if (as->walkers == 0) {
+			cv_broadcast(as_walk_cv, as_list_lock);
+		}
+		as = as->next;
+	}
+	lock_release(as_list_lock);
+}
+
+void
+as_printall(void)
+{
+	struct as_stats st, total = { 0, 0, 0, 0 };
+	unsigned count = 0;
+
+	kprintf("  pid  resident   swapped    shared  pt pages\n");
+
+	lock_acquire(as_list_lock);
+	for (struct addrspace *as = as_list; as != NULL; as = as->next) {
+		as_getstats(as, &st);
+		kprintf("%5d %9u %9u %9u %9u\n", as->pid,
+			st.resident, st.swapped, st.shared, st.ptpages);
+		total.resident += st.resident;
+		total.swapped += st.swapped;
+		total.shared += st.shared;
+		total.ptpages += st.ptpages;
+		count++;
+	}
+	lock_release(as_list_lock);
+
+	kprintf("%u address spaces: %u pages resident (%u shared), %u swapped, %u page table pages\n",
+		count, total.resident, total.shared, total.swapped, total.ptpages);
+}
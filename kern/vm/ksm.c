@@ -0,0 +1,349 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <clock.h>
+#include <thread.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <ksm.h>
+
+/*
+ * Same-page merging (see ksm.h).
+ *
+ * Each pass hashes every candidate page into a table that lasts for
+ * the pass, and a page whose hash is already there is compared with
+ * the page found first and merged into it if they match. Candidates
+ * are resident pages with a frame of their own, not yet written back
+ * to a file mapping.
+ *
+ * Pages are hashed without holding them, so a hash only says where to
+ * look. Before a page is compared or changed it is held the way the
+ * pager holds its victim (frame_trybusy), which keeps its owner, the
+ * pager and as_destroy() off the page table entry, and write protected
+ * on every cpu. The first page of a kind that something is merged into
+ * then gets an extra reference from the table for the rest of the
+ * pass; being shared, its frame can't be written, so it needs no
+ * holding after that.
+ */
+
+#define KSM_SLOTS 2048 /* hash table size, a power of two */
+#define KSM_MAXFILL (KSM_SLOTS * 3 / 4)
+
+struct ksm_entry {
+    uint32_t hash; /* of the page contents */
+    struct addrspace *as; /* where the page was found */
+    vaddr_t vaddr;
+    paddr_t frame; /* the frame it had then, 0 if the slot is unused */
+    bool held; /* the table holds a reference to the frame */
+};
+static struct ksm_entry *ksm_table;
+static unsigned ksm_used;
+
+static struct lock *ksm_lock; /* protects ksm_on and ksm_thread_started */
+static struct cv *ksm_cv; /* the thread waits here while turned off */
+static bool ksm_on = false;
+static bool ksm_thread_started = false;
+
+static struct spinlock ksm_stats_lock = SPINLOCK_INITIALIZER;
+
+/* statistics, protected by ksm_stats_lock */
+static struct {
+    uint32_t passes; /* scans of all address spaces */
+    uint32_t scanned; /* candidate pages hashed */
+    uint32_t merged; /* pages mapped to another page's frame */
+    uint32_t zeroed; /* pages of zeroes mapped to the zero page */
+    uint32_t scanms; /* time spent scanning, in milliseconds */
+} ksm_stats;
+
+// counts for one pass, added to ksm_stats at the end
+struct ksm_pass {
+    uint32_t scanned;
+    uint32_t merged;
+    uint32_t zeroed;
+};
+
+static bool
+ksm_samepage(paddr_t a, paddr_t b)
+{
+    const uint32_t *wa = (const uint32_t *)PADDR_TO_KVADDR(a);
+    const uint32_t *wb = (const uint32_t *)PADDR_TO_KVADDR(b);
+
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (wa[i] != wb[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Hold page VADDR of AS, in its private frame FRAME, and write protect
+ * it on every cpu, so it stays as it is until ksm_release(). Returns
+ * its page table entry, or NULL if it is no longer a candidate.
+ */
+static paddr_t *
+ksm_hold(struct addrspace *as, vaddr_t vaddr, paddr_t frame)
+{
+    if (!frame_trybusy(frame, as, vaddr)) {
+        return NULL;
+    }
+
+    // the frame is mapped there, so the level 2 table is too, and
+    // neither goes away while the frame is busy
+    paddr_t *pte = &as->pagetable[PT_LVL1(vaddr)][PT_LVL2(vaddr)];
+    if ((*pte & TLBLO_VALID) == 0 || (*pte & PAGE_FRAME) != frame ||
+        (*pte & PTE_FDIRTY) != 0) {
+        frame_evict_done(frame, false);
+        return NULL;
+    }
+
+    // from now on writes to the page fault
+    if (*pte & TLBLO_DIRTY) {
+        *pte &= ~TLBLO_DIRTY;
+        vm_tlb_invalidate(as, vaddr);
+    }
+    return pte;
+}
+
+static void
+ksm_release(paddr_t frame)
+{
+    frame_evict_done(frame, false);
+}
+
+/*
+ * Point the entry PTE, for held page VADDR of AS, at FRAME (read-only)
+ * and free the private frame OLD it had.
+ */
+static void
+ksm_remap(struct addrspace *as, vaddr_t vaddr, paddr_t *pte, paddr_t old,
+          paddr_t frame)
+{
+    if (frame != vm_zeropage) {
+        frame_incref(frame);
+    }
+    // keep PTE_TRAP, which also keeps PROT_NONE pages from the refill
+    // fast path
+    *pte = frame | TLBLO_VALID | (*pte & PTE_TRAP);
+    vm_tlb_invalidate(as, vaddr);
+
+    // take the old frame away from the pager before letting it go
+    frame_setowner(old, NULL, 0);
+    ksm_release(old);
+    free_kpages(PADDR_TO_KVADDR(old));
+}
+
+/*
+ * Try to merge held page VADDR of AS, in FRAME, into the page found
+ * first in table entry E.
+ */
+static bool
+ksm_merge(struct ksm_entry *e, struct addrspace *as, vaddr_t vaddr,
+          paddr_t *pte, paddr_t frame)
+{
+    if (e->frame == frame) {
+        return false;
+    }
+
+    // the first page may have changed since it went into the table
+    bool hold = !e->held;
+    if (hold && ksm_hold(e->as, e->vaddr, e->frame) == NULL) {
+        return false;
+    }
+    if (!ksm_samepage(e->frame, frame)) {
+        if (hold) {
+            ksm_release(e->frame);
+        }
+        return false;
+    }
+    if (hold) {
+        frame_incref(e->frame);
+        e->held = true;
+        ksm_release(e->frame);
+    }
+
+    ksm_remap(as, vaddr, pte, frame, e->frame);
+    return true;
+}
+
+/*
+ * Look at one page table entry, for as_walkall().
+ */
+static void
+ksm_page(struct addrspace *as, vaddr_t vaddr, paddr_t *pte, void *data)
+{
+    struct ksm_pass *pass = data;
+
+    paddr_t entry = *pte;
+    paddr_t frame = entry & PAGE_FRAME;
+    if ((entry & TLBLO_VALID) == 0 || PTE_ZEROPAGE(entry) ||
+        (entry & PTE_FDIRTY) != 0 || frame_refcount(frame) != 1) {
+        return;
+    }
+    pass->scanned++;
+
+    const uint32_t *words = (const uint32_t *)PADDR_TO_KVADDR(frame);
+    uint32_t hash = 2166136261U, bits = 0;
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+        hash = (hash ^ words[i]) * 16777619U;
+        bits |= words[i];
+    }
+
+    if (bits == 0) {
+        pte = ksm_hold(as, vaddr, frame);
+        if (pte == NULL) {
+            return;
+        }
+        if (ksm_samepage(frame, vm_zeropage)) {
+            ksm_remap(as, vaddr, pte, frame, vm_zeropage);
+            pass->zeroed++;
+        } else {
+            ksm_release(frame);
+        }
+        return;
+    }
+
+    // the page is only held once there is something to merge it with
+    paddr_t *held = NULL;
+    unsigned slot = hash & (KSM_SLOTS - 1);
+    while (ksm_table[slot].frame != 0) {
+        if (ksm_table[slot].hash == hash) {
+            if (held == NULL) {
+                held = ksm_hold(as, vaddr, frame);
+                if (held == NULL) {
+                    return;
+                }
+            }
+            if (ksm_merge(&ksm_table[slot], as, vaddr, held, frame)) {
+                pass->merged++;
+                return;
+            }
+        }
+        slot = (slot + 1) & (KSM_SLOTS - 1);
+    }
+    if (held != NULL) {
+        ksm_release(frame);
+    }
+
+    // the first of its kind, for later pages to be merged into
+    if (ksm_used < KSM_MAXFILL) {
+        ksm_table[slot].hash = hash;
+        ksm_table[slot].as = as;
+        ksm_table[slot].vaddr = vaddr;
+        ksm_table[slot].frame = frame;
+        ksm_table[slot].held = false;
+        ksm_used++;
+    }
+}
+
+static void
+ksm_scan(void)
+{
+    struct ksm_pass pass = { 0, 0, 0 };
+    struct timespec start, end, diff;
+
+    for (unsigned i = 0; i < KSM_SLOTS; i++) {
+        ksm_table[i].frame = 0;
+    }
+    ksm_used = 0;
+
+    gettime(&start);
+    as_walkall(ksm_page, &pass);
+    gettime(&end);
+    timespec_sub(&end, &start, &diff);
+
+    // drop the references the table took
+    for (unsigned i = 0; i < KSM_SLOTS; i++) {
+        if (ksm_table[i].frame != 0 && ksm_table[i].held) {
+            free_kpages(PADDR_TO_KVADDR(ksm_table[i].frame));
+        }
+    }
+
+    spinlock_acquire(&ksm_stats_lock);
+    ksm_stats.passes++;
+    ksm_stats.scanned += pass.scanned;
+    ksm_stats.merged += pass.merged;
+    ksm_stats.zeroed += pass.zeroed;
+    ksm_stats.scanms += diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+    spinlock_release(&ksm_stats_lock);
+}
+
+static void
+ksm_thread(void *data1, unsigned long data2)
+{
+    (void)data1;
+    (void)data2;
+
+    while (1) {
+        lock_acquire(ksm_lock);
+        while (!ksm_on) {
+            cv_wait(ksm_cv, ksm_lock);
+        }
+        lock_release(ksm_lock);
+
+        ksm_scan();
+        clocksleep(KSM_INTERVAL);
+    }
+}
+
+void
+ksm_bootstrap(void)
+{
+    ksm_lock = lock_create("ksm");
+    ksm_cv = cv_create("ksm");
+    if (ksm_lock == NULL || ksm_cv == NULL) {
+        panic("ksm_bootstrap: out of memory\n");
+    }
+}
+
+int
+ksm_enable(bool on)
+{
+    int result = 0;
+
+    lock_acquire(ksm_lock);
+    if (on && !ksm_thread_started) {
+        ksm_table = kmalloc(KSM_SLOTS * sizeof(struct ksm_entry));
+        if (ksm_table == NULL) {
+            lock_release(ksm_lock);
+            return ENOMEM;
+        }
+        result = thread_fork("ksm", NULL, ksm_thread, NULL, 0);
+        if (result) {
+            kfree(ksm_table);
+            ksm_table = NULL;
+            lock_release(ksm_lock);
+            return result;
+        }
+        ksm_thread_started = true;
+    }
+    ksm_on = on;
+    cv_signal(ksm_cv, ksm_lock);
+    lock_release(ksm_lock);
+
+    return result;
+}
+
+void
+ksm_printstats(void)
+{
+    uint32_t passes, scanned, merged, zeroed, scanms;
+    bool on = ksm_on;
+
+    spinlock_acquire(&ksm_stats_lock);
+    passes = ksm_stats.passes;
+    scanned = ksm_stats.scanned;
+    merged = ksm_stats.merged;
+    zeroed = ksm_stats.zeroed;
+    scanms = ksm_stats.scanms;
+    spinlock_release(&ksm_stats_lock);
+
+    kprintf("Page merging: %s, %u passes, %u pages scanned in %u ms (%u us per page), "
+            "%u pages merged, %u mapped to the zero page\n",
+            on ? "on" : "off", passes, scanned, scanms,
+            scanned ? (uint32_t)((uint64_t)scanms * 1000 / scanned) : 0,
+            merged, zeroed);
+}
@@ -0,0 +1,283 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <vm.h>
+#include <pagecache.h>
+
+/*
+ * Page cache for executables (see pagecache.h).
+ *
+ * Entries live on a small hash table protected by pc_lock. The lock
+ * is a spinlock and is never held across an allocation, I/O or vnode
+ * reference drop, because pagecache_reclaim() is called from inside
+ * alloc_kpages().
+ *
+ * pc_files counts the cached pages of each file, so that a write to a
+ * file with nothing cached, which is nearly every write, costs
+ * pagecache_invalidate() a short scan and not a walk of the whole
+ * table. Pages of a file beyond the first PC_FILES are not cached.
+ */
+
+#define PC_BUCKETS 64
+#define PC_FILES 32
+
+struct pc_entry {
+    struct vnode *v;
+    off_t offset;
+    paddr_t paddr;
+    struct pc_entry *next;
+};
+
+static struct pc_entry *pc_table[PC_BUCKETS];
+static unsigned pc_count = 0;
+
+static struct {
+    struct vnode *v; /* NULL if the slot is free */
+    unsigned npages;
+} pc_files[PC_FILES];
+
+static struct spinlock pc_lock = SPINLOCK_INITIALIZER;
+
+/* statistics, protected by pc_lock */
+static struct {
+    uint32_t hits; /* faults that found the page cached */
+    uint32_t misses; /* faults that had to read it */
+    uint32_t races; /* pages read twice by concurrent faults */
+    uint32_t reclaimed; /* pages dropped to free memory */
+    uint32_t invalidated; /* pages dropped because their file changed */
+} pc_stats;
+
+static unsigned
+pc_hash(struct vnode *v, off_t offset)
+{
+    return (((uintptr_t)v >> 4) ^ (unsigned)(offset / PAGE_SIZE)) % PC_BUCKETS;
+}
+
+// find an entry, with pc_lock held
+static struct pc_entry *
+pc_find(struct vnode *v, off_t offset)
+{
+    struct pc_entry *e;
+
+    for (e = pc_table[pc_hash(v, offset)]; e != NULL; e = e->next) {
+        if (e->v == v && e->offset == offset) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// find V's slot in pc_files, with pc_lock held, or give it a free one
+// if ADD is set; -1 if there is none
+static int
+pc_file(struct vnode *v, bool add)
+{
+    int k, slot = -1;
+
+    for (k = 0; k < PC_FILES; k++) {
+        if (pc_files[k].v == v) {
+            return k;
+        }
+        if (pc_files[k].v == NULL && slot < 0) {
+            slot = k;
+        }
+    }
+    if (add && slot >= 0) {
+        pc_files[slot].v = v;
+        pc_files[slot].npages = 0;
+        return slot;
+    }
+    return -1;
+}
+
+// count a page of V gone from the cache, with pc_lock held
+static void
+pc_file_drop(struct vnode *v)
+{
+    int k = pc_file(v, false);
+
+    KASSERT(k >= 0 && pc_files[k].npages > 0);
+    if (--pc_files[k].npages == 0) {
+        pc_files[k].v = NULL;
+    }
+}
+
+// free entries taken off the table, without pc_lock
+static void
+pc_free_entries(struct pc_entry *victims)
+{
+    struct pc_entry *e;
+
+    while (victims != NULL) {
+        e = victims;
+        victims = e->next;
+        free_kpages(PADDR_TO_KVADDR(e->paddr));
+        VOP_DECREF(e->v);
+        kfree(e);
+    }
+}
+
+paddr_t
+pagecache_lookup(struct vnode *v, off_t offset)
+{
+    struct pc_entry *e;
+    paddr_t paddr = 0;
+
+    spinlock_acquire(&pc_lock);
+    e = pc_find(v, offset);
+    if (e != NULL) {
+        paddr = e->paddr;
+        frame_incref(paddr);
+        pc_stats.hits++;
+    }
+    else {
+        pc_stats.misses++;
+    }
+    spinlock_release(&pc_lock);
+
+    return paddr;
+}
+
+paddr_t
+pagecache_insert(struct vnode *v, off_t offset, paddr_t paddr)
+{
+    struct pc_entry *e, *new;
+    unsigned h;
+
+    KASSERT(offset % PAGE_SIZE == 0);
+
+    // allocate first: nothing may be allocated under pc_lock
+    new = kmalloc(sizeof(*new));
+    if (new == NULL) {
+        // just don't cache it
+        return paddr;
+    }
+
+    spinlock_acquire(&pc_lock);
+    e = pc_find(v, offset);
+    if (e != NULL) {
+        // another fault read the page first, use theirs
+        paddr_t cached = e->paddr;
+        frame_incref(cached);
+        pc_stats.races++;
+        spinlock_release(&pc_lock);
+
+        kfree(new);
+        free_kpages(PADDR_TO_KVADDR(paddr));
+        return cached;
+    }
+
+    int k = pc_file(v, true);
+    if (k < 0) {
+        // too many files cached already
+        spinlock_release(&pc_lock);
+        kfree(new);
+        return paddr;
+    }
+    pc_files[k].npages++;
+
+    h = pc_hash(v, offset);
+    new->v = v;
+    new->offset = offset;
+    new->paddr = paddr;
+    new->next = pc_table[h];
+    pc_table[h] = new;
+    pc_count++;
+
+    // one reference for the cache, one for the caller's mapping
+    frame_incref(paddr);
+    VOP_INCREF(v);
+    spinlock_release(&pc_lock);
+
+    return paddr;
+}
+
+unsigned
+pagecache_reclaim(unsigned max)
+{
+    struct pc_entry *victims = NULL, *e, **ep;
+    unsigned h, n = 0;
+
+    spinlock_acquire(&pc_lock);
+    for (h = 0; h < PC_BUCKETS && n < max; h++) {
+        ep = &pc_table[h];
+        while (*ep != NULL && n < max) {
+            e = *ep;
+            // only the cache refers to the frame, and new references
+            // can only be taken under pc_lock
+            if (frame_refcount(e->paddr) == 1) {
+                *ep = e->next;
+                e->next = victims;
+                victims = e;
+                pc_count--;
+                pc_file_drop(e->v);
+                n++;
+            }
+            else {
+                ep = &e->next;
+            }
+        }
+    }
+    pc_stats.reclaimed += n;
+    spinlock_release(&pc_lock);
+
+    pc_free_entries(victims);
+    return n;
+}
+
+void
+pagecache_invalidate(struct vnode *v)
+{
+    struct pc_entry *victims = NULL, *e, **ep;
+    unsigned h, n = 0;
+    int k;
+
+    spinlock_acquire(&pc_lock);
+    k = pc_file(v, false);
+    if (k < 0) {
+        spinlock_release(&pc_lock);
+        return;
+    }
+    for (h = 0; h < PC_BUCKETS; h++) {
+        ep = &pc_table[h];
+        while (*ep != NULL) {
+            e = *ep;
+            if (e->v == v) {
+                *ep = e->next;
+                e->next = victims;
+                victims = e;
+                n++;
+            }
+            else {
+                ep = &e->next;
+            }
+        }
+    }
+    KASSERT(n == pc_files[k].npages);
+    pc_files[k].v = NULL;
+    pc_count -= n;
+    pc_stats.invalidated += n;
+    spinlock_release(&pc_lock);
+
+    pc_free_entries(victims);
+}
+
+void
+pagecache_printstats(void)
+{
+    uint32_t count, hits, misses, races, reclaimed, invalidated;
+
+    spinlock_acquire(&pc_lock);
+    count = pc_count;
+    hits = pc_stats.hits;
+    misses = pc_stats.misses;
+    races = pc_stats.races;
+    reclaimed = pc_stats.reclaimed;
+    invalidated = pc_stats.invalidated;
+    spinlock_release(&pc_lock);
+
+    kprintf("Page cache: %u pages cached, %u hits, %u misses, %u races, %u reclaimed, "
+            "%u invalidated\n",
+            count, hits, misses, races, reclaimed, invalidated);
+}
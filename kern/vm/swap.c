@@ -0,0 +1,744 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <thread.h>
+#include <wchan.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagecache.h>
+#include <swap.h>
+
+/*
+ * Swap space management.
+ *
+ * The swap device is divided into page-sized slots. swap_map tracks
+ * which slots are in use and swap_refs how many page table entries
+ * refer to each one. Both are protected by swap_lock; the disk I/O
+ * itself happens without it.
+ *
+ * Before a page goes to disk we try to compress it into the pool, a
+ * few pages of memory set aside at boot and handed out in chunks of
+ * ZCHUNK bytes. A slot whose page is in the pool (swap_zslots[slot]
+ * has chunks) is never written to disk, and reading it back is just
+ * decompressing it. The pool is protected by swap_lock too, which is
+ * held while compressing and decompressing, as that never sleeps.
+ *
+ * swap_owners[slot] records which page of which address space was
+ * last paged out to each slot, so a page-in can find the neighbouring
+ * slots of the same address space and read them in with it (see
+ * swap_cluster()). It is only a hint: the address space may be gone
+ * and the slot shared or reused since, and the caller has to check
+ * its page table before trusting it.
+ */
+
+static struct vnode *swap_vnode = NULL;
+static struct bitmap *swap_map;
+static unsigned char *swap_refs;
+static struct {
+    struct addrspace *as;
+    vaddr_t vaddr;
+} *swap_owners;
+static unsigned swap_nslots;
+static unsigned swap_hint; /* where swap_alloc_run() looks first */
+
+#define ZCHUNK    64 /* bytes */
+#define ZCHUNKS   (SWAP_ZPOOL_PAGES * PAGE_SIZE / ZCHUNK)
+#define ZMAXWORDS (PAGE_SIZE * 3 / 4 / sizeof(uint32_t)) /* not worth it beyond */
+
+static uint32_t *swap_zpool; /* NULL without a pool */
+static struct bitmap *swap_zmap; /* chunks of the pool in use */
+static struct {
+    uint16_t chunk; /* where the page starts in the pool */
+    uint16_t nchunks; /* its length, 0 if the slot is on disk */
+} *swap_zslots;
+static uint32_t swap_zbuf[PAGE_SIZE / sizeof(uint32_t)]; /* compressor output */
+
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * The pageout thread sleeps on swap_pageout_wchan until kicked (see
+ * swap_pageout()). Both are protected by swap_pageout_lock.
+ */
+static struct wchan *swap_pageout_wchan;
+static bool swap_pageout_kicked = false;
+static struct spinlock swap_pageout_lock = SPINLOCK_INITIALIZER;
+
+static void swap_pageout(void *data1, unsigned long data2);
+
+/* statistics, protected by swap_lock */
+static struct {
+    uint32_t pageouts; /* pages written to swap */
+    uint32_t clusters; /* writes they took */
+    uint32_t pageins; /* pages read from swap */
+    uint32_t reads; /* reads they took */
+    uint32_t clean; /* evictions that needed no write */
+    uint32_t wakeups; /* times the pageout thread was kicked */
+    uint32_t background; /* frames it freed */
+    uint32_t stalls; /* allocations that had to evict a page themselves */
+    uint32_t zstores; /* page-outs compressed into the pool */
+    uint32_t zloads; /* page-ins decompressed from it */
+    uint32_t zrejects; /* page-outs that didn't compress well enough */
+    uint32_t zfull; /* page-outs that found no room in the pool */
+    uint32_t zpages; /* pages in the pool now */
+    uint32_t zchunks; /* chunks of the pool they take up */
+} swap_stats;
+
+void
+swap_bootstrap(void)
+{
+    struct stat st;
+    int result;
+
+    result = vfs_swapon(SWAP_DEVICE, &swap_vnode);
+    if (result) {
+        kprintf("vm: swap disabled (%s: %s)\n", SWAP_DEVICE, strerror(result));
+        swap_vnode = NULL;
+        return;
+    }
+
+    result = VOP_STAT(swap_vnode, &st);
+    if (result) {
+        panic("vm: stat of swap device failed: %s\n", strerror(result));
+    }
+
+    swap_nslots = st.st_size / PAGE_SIZE;
+    if (swap_nslots == 0) {
+        kprintf("vm: swap disabled (%s is empty)\n", SWAP_DEVICE);
+        VOP_DECREF(swap_vnode);
+        swap_vnode = NULL;
+        return;
+    }
+
+    swap_map = bitmap_create(swap_nslots);
+    swap_refs = kmalloc(swap_nslots * sizeof(unsigned char));
+    swap_owners = kmalloc(swap_nslots * sizeof(*swap_owners));
+    if (swap_map == NULL || swap_refs == NULL || swap_owners == NULL) {
+        panic("vm: out of memory setting up swap\n");
+    }
+    bzero(swap_refs, swap_nslots * sizeof(unsigned char));
+    bzero(swap_owners, swap_nslots * sizeof(*swap_owners));
+
+    kprintf("vm: %uk of swap on %s\n", swap_nslots * (PAGE_SIZE / 1024), SWAP_DEVICE);
+
+    // the compressed pool is only an optimisation, so do without it
+    // if there is no memory for it
+    swap_zslots = kmalloc(swap_nslots * sizeof(*swap_zslots));
+    swap_zmap = bitmap_create(ZCHUNKS);
+    vaddr_t pool = alloc_kpages(SWAP_ZPOOL_PAGES);
+    if (swap_zslots == NULL || swap_zmap == NULL || pool == 0) {
+        kprintf("vm: no compressed swap pool\n");
+    } else {
+        bzero(swap_zslots, swap_nslots * sizeof(*swap_zslots));
+        swap_zpool = (uint32_t *)pool;
+        kprintf("vm: %uk compressed swap pool\n",
+                SWAP_ZPOOL_PAGES * (PAGE_SIZE / 1024));
+    }
+
+    swap_pageout_wchan = wchan_create("pageout");
+    if (swap_pageout_wchan == NULL) {
+        panic("vm: out of memory setting up swap\n");
+    }
+    result = thread_fork("pageout", NULL, swap_pageout, NULL, 0);
+    if (result) {
+        panic("vm: cannot start pageout thread: %s\n", strerror(result));
+    }
+}
+
+// number of swap slots, 0 without swap
+unsigned
+swap_size(void)
+{
+    return swap_vnode != NULL ? swap_nslots : 0;
+}
+
+// transfer N pages between the frames at PADDRS and the swap slots
+// from SLOT on, in one I/O
+static int
+swap_io(unsigned slot, const paddr_t *paddrs, unsigned n, enum uio_rw rw)
+{
+    struct iovec iov[SWAP_CLUSTER];
+    struct uio u;
+    int result;
+
+    KASSERT(n > 0 && n <= SWAP_CLUSTER);
+    for (unsigned i = 0; i < n; i++) {
+        iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+        iov[i].iov_len = PAGE_SIZE;
+    }
+    u.uio_iov = iov;
+    u.uio_iovcnt = n;
+    u.uio_offset = (off_t)slot * PAGE_SIZE;
+    u.uio_resid = n * PAGE_SIZE;
+    u.uio_segflg = UIO_SYSSPACE;
+    u.uio_rw = rw;
+    u.uio_space = NULL;
+
+    if (rw == UIO_READ) {
+        result = VOP_READ(swap_vnode, &u);
+    } else {
+        result = VOP_WRITE(swap_vnode, &u);
+    }
+    if (result) {
+        return result;
+    }
+
+    // a short transfer means we ran off the end of the device
+    if (u.uio_resid != 0) {
+        return EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Compress the page at SRC into at most MAX words at DST, as a series
+ * of records each starting with a header word: (count << 1 | 1) is
+ * followed by one word that is repeated count times, and (count << 1)
+ * by count words as they are. Runs of zeroes or of any other repeated
+ * word, which pages of memory are full of, take two words. Returns the
+ * number of words written, or 0 if they didn't fit.
+ */
+static unsigned
+swap_compress(const uint32_t *src, uint32_t *dst, unsigned max)
+{
+    const unsigned n = PAGE_SIZE / sizeof(uint32_t);
+    unsigned i = 0, out = 0, literal = 0;
+    bool inliteral = false;
+
+    while (i < n) {
+        unsigned run = 1;
+        while (i + run < n && src[i + run] == src[i]) {
+            run++;
+        }
+
+        if (run >= 3) {
+            if (out + 2 > max) {
+                return 0;
+            }
+            dst[out++] = (run << 1) | 1;
+            dst[out++] = src[i];
+            inliteral = false;
+            i += run;
+            continue;
+        }
+
+        // too short to be worth a record, add it to the literal one
+        if (!inliteral) {
+            if (out + 1 > max) {
+                return 0;
+            }
+            literal = out++;
+            dst[literal] = 0;
+            inliteral = true;
+        }
+        while (run-- > 0) {
+            if (out + 1 > max) {
+                return 0;
+            }
+            dst[out++] = src[i++];
+            dst[literal] += 2;
+        }
+    }
+    return out;
+}
+
+static void
+swap_decompress(const uint32_t *src, uint32_t *dst)
+{
+    const unsigned n = PAGE_SIZE / sizeof(uint32_t);
+    unsigned out = 0;
+
+    while (out < n) {
+        uint32_t header = *src++;
+        unsigned count = header >> 1;
+        KASSERT(count > 0 && out + count <= n);
+        if (header & 1) {
+            uint32_t word = *src++;
+            while (count-- > 0) {
+                dst[out++] = word;
+            }
+        } else {
+            while (count-- > 0) {
+                dst[out++] = *src++;
+            }
+        }
+    }
+}
+
+// find and take NCHUNKS free chunks in a row, with swap_lock held
+static bool
+swap_zalloc(unsigned nchunks, unsigned *chunk)
+{
+    unsigned run = 0;
+
+    for (unsigned i = 0; i < ZCHUNKS; i++) {
+        if (bitmap_isset(swap_zmap, i)) {
+            run = 0;
+            continue;
+        }
+        if (++run == nchunks) {
+            *chunk = i + 1 - nchunks;
+            for (unsigned j = *chunk; j <= i; j++) {
+                bitmap_mark(swap_zmap, j);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// store the frame at PADDR in the pool as slot SLOT, if it will go
+static bool
+swap_zstore(unsigned slot, paddr_t paddr)
+{
+    unsigned words, nchunks, chunk;
+
+    if (swap_zpool == NULL) {
+        return false;
+    }
+
+    spinlock_acquire(&swap_lock);
+    words = swap_compress((const uint32_t *)PADDR_TO_KVADDR(paddr), swap_zbuf, ZMAXWORDS);
+    if (words == 0) {
+        swap_stats.zrejects++;
+        spinlock_release(&swap_lock);
+        return false;
+    }
+    nchunks = DIVROUNDUP(words * sizeof(uint32_t), ZCHUNK);
+    if (!swap_zalloc(nchunks, &chunk)) {
+        swap_stats.zfull++;
+        spinlock_release(&swap_lock);
+        return false;
+    }
+    memcpy(swap_zpool + chunk * (ZCHUNK / sizeof(uint32_t)), swap_zbuf,
+           words * sizeof(uint32_t));
+    swap_zslots[slot].chunk = chunk;
+    swap_zslots[slot].nchunks = nchunks;
+    swap_stats.zstores++;
+    swap_stats.zpages++;
+    swap_stats.zchunks += nchunks;
+    spinlock_release(&swap_lock);
+
+    return true;
+}
+
+/*
+ * Take up to MAX free slots in a row, the first at or after the last
+ * ones taken if possible, so clusters written one after another end up
+ * next to each other. Returns how many were taken, from *FIRST on.
+ */
+static unsigned
+swap_alloc_run(unsigned max, unsigned *first)
+{
+    unsigned n = 0;
+
+    spinlock_acquire(&swap_lock);
+    for (unsigned k = 0; k < swap_nslots; k++) {
+        unsigned slot = (swap_hint + k) % swap_nslots;
+        if (!bitmap_isset(swap_map, slot)) {
+            *first = slot;
+            while (n < max && slot + n < swap_nslots &&
+                   !bitmap_isset(swap_map, slot + n)) {
+                bitmap_mark(swap_map, slot + n);
+                swap_refs[slot + n] = 1;
+                n++;
+            }
+            swap_hint = slot + n;
+            break;
+        }
+    }
+    spinlock_release(&swap_lock);
+
+    return n;
+}
+
+/*
+ * Find the slots after SLOT that can be read in along with it: up to
+ * MAX in a row that are on disk, referenced by one page table entry
+ * and were last paged out from AS, none if SLOT itself is in the pool.
+ * The pages they were paged out from go in VADDRS.
+ */
+unsigned
+swap_cluster(unsigned slot, struct addrspace *as, vaddr_t *vaddrs, unsigned max)
+{
+    unsigned n = 0;
+
+    KASSERT(slot < swap_nslots);
+
+    spinlock_acquire(&swap_lock);
+    if (swap_zpool != NULL && swap_zslots[slot].nchunks > 0) {
+        spinlock_release(&swap_lock);
+        return 0;
+    }
+    while (n < max && slot + 1 + n < swap_nslots) {
+        unsigned next = slot + 1 + n;
+        if (swap_refs[next] != 1 || swap_owners[next].as != as ||
+            (swap_zpool != NULL && swap_zslots[next].nchunks > 0)) {
+            break;
+        }
+        vaddrs[n++] = swap_owners[next].vaddr;
+    }
+    spinlock_release(&swap_lock);
+
+    return n;
+}
+
+int
+swap_in(unsigned slot, const paddr_t *paddrs, unsigned n)
+{
+    KASSERT(swap_vnode != NULL);
+    KASSERT(n > 0 && slot + n <= swap_nslots);
+
+    spinlock_acquire(&swap_lock);
+    if (swap_zpool != NULL && swap_zslots[slot].nchunks > 0) {
+        KASSERT(n == 1);
+        swap_decompress(swap_zpool + swap_zslots[slot].chunk * (ZCHUNK / sizeof(uint32_t)),
+                        (uint32_t *)PADDR_TO_KVADDR(paddrs[0]));
+        swap_stats.zloads++;
+        spinlock_release(&swap_lock);
+        return 0;
+    }
+    swap_stats.pageins += n;
+    swap_stats.reads++;
+    spinlock_release(&swap_lock);
+
+    return swap_io(slot, paddrs, n, UIO_READ);
+}
+
+void
+swap_incref(unsigned slot)
+{
+    spinlock_acquire(&swap_lock);
+    KASSERT(bitmap_isset(swap_map, slot));
+    KASSERT(swap_refs[slot] < 255);
+    swap_refs[slot]++;
+    spinlock_release(&swap_lock);
+}
+
+void
+swap_free(unsigned slot)
+{
+    spinlock_acquire(&swap_lock);
+    KASSERT(bitmap_isset(swap_map, slot));
+    KASSERT(swap_refs[slot] > 0);
+    swap_refs[slot]--;
+    if (swap_refs[slot] == 0) {
+        bitmap_unmark(swap_map, slot);
+        if (swap_zpool != NULL && swap_zslots[slot].nchunks > 0) {
+            unsigned chunk = swap_zslots[slot].chunk;
+            unsigned nchunks = swap_zslots[slot].nchunks;
+            for (unsigned j = chunk; j < chunk + nchunks; j++) {
+                bitmap_unmark(swap_zmap, j);
+            }
+            swap_zslots[slot].nchunks = 0;
+            swap_stats.zpages--;
+            swap_stats.zchunks -= nchunks;
+        }
+    }
+    spinlock_release(&swap_lock);
+}
+
+/*
+ * A page being evicted, for swap_evict_batch().
+ */
+struct swap_victim {
+    paddr_t paddr; /* its frame */
+    struct addrspace *as; /* and where it is mapped */
+    vaddr_t vaddr;
+    paddr_t *pte;
+    paddr_t fdirty; /* PTE_FDIRTY if set in its entry */
+    bool dirty; /* needs writing out */
+    unsigned slot; /* where it went, or FRAME_NOSLOT */
+};
+
+/*
+ * Write out the dirty victims V[0..N-1], first trying to compress each
+ * into the pool and then writing the rest to disk in clusters of slots
+ * in a row, as few I/Os as the free slots allow. Victims that could
+ * not be written are left with no slot.
+ */
+static void
+swap_write_victims(struct swap_victim *v, unsigned n)
+{
+    struct swap_victim *todisk[SWAP_CLUSTER];
+    paddr_t paddrs[SWAP_CLUSTER];
+    unsigned ndisk = 0;
+
+    for (unsigned i = 0; i < n; i++) {
+        KASSERT(v[i].dirty && v[i].slot == FRAME_NOSLOT);
+        if (swap_zpool != NULL) {
+            // any slot will do for a compressed page
+            unsigned slot;
+            int result;
+
+            spinlock_acquire(&swap_lock);
+            result = bitmap_alloc(swap_map, &slot);
+            if (result == 0) {
+                swap_refs[slot] = 1;
+            }
+            spinlock_release(&swap_lock);
+            if (result) {
+                // swap is full
+                continue;
+            }
+            if (swap_zstore(slot, v[i].paddr)) {
+                v[i].slot = slot;
+                continue;
+            }
+            swap_free(slot);
+        }
+        todisk[ndisk++] = &v[i];
+    }
+
+    for (unsigned done = 0; done < ndisk; ) {
+        unsigned first, got;
+
+        got = swap_alloc_run(ndisk - done, &first);
+        if (got == 0) {
+            break;
+        }
+        for (unsigned i = 0; i < got; i++) {
+            paddrs[i] = todisk[done + i]->paddr;
+        }
+        if (swap_io(first, paddrs, got, UIO_WRITE)) {
+            for (unsigned i = 0; i < got; i++) {
+                swap_free(first + i);
+            }
+        } else {
+            for (unsigned i = 0; i < got; i++) {
+                todisk[done + i]->slot = first + i;
+            }
+            spinlock_acquire(&swap_lock);
+            swap_stats.pageouts += got;
+            swap_stats.clusters++;
+            spinlock_release(&swap_lock);
+        }
+        done += got;
+    }
+}
+
+// note that the page at VADDR of AS went out to SLOT
+static void
+swap_setowner(unsigned slot, struct addrspace *as, vaddr_t vaddr)
+{
+    spinlock_acquire(&swap_lock);
+    swap_owners[slot].as = as;
+    swap_owners[slot].vaddr = vaddr;
+    spinlock_release(&swap_lock);
+}
+
+/*
+ * Page out up to MAX victims. Each victim's page table entry is
+ * pointed at its swap slot and its frame, still holding its one
+ * reference, is handed back in FRAMES. Returns how many there are.
+ *
+ * Clean pages need no I/O: if they were read from swap the slot still
+ * holds their contents, and if they were never written at all the
+ * entry becomes PTE_DROPPED so the next fault fills it again. (It is
+ * not cleared, as only the owner changes which entries are in use.)
+ */
+static unsigned
+swap_evict_batch(paddr_t *frames, unsigned max)
+{
+    struct swap_victim v[SWAP_CLUSTER], dirty[SWAP_CLUSTER];
+    unsigned n, ndirty = 0, nclean = 0, k = 0;
+
+    KASSERT(max <= SWAP_CLUSTER);
+
+    for (n = 0; n < max; n++) {
+        v[n].paddr = frame_pick_victim(&v[n].as, &v[n].vaddr, &v[n].dirty,
+                                       &v[n].slot);
+        if (v[n].paddr == 0) {
+            break;
+        }
+        v[n].pte = &v[n].as->pagetable[PT_LVL1(v[n].vaddr)][PT_LVL2(v[n].vaddr)];
+        KASSERT((*v[n].pte & PAGE_FRAME) == v[n].paddr);
+
+        // the owner must not keep writing to the page while it goes
+        // out, so send its next access to vm_fault(), which waits for us
+        vm_tlb_trap(v[n].as, v[n].vaddr);
+
+        // a file mapping's page not yet written back stays marked as such
+        v[n].fdirty = *v[n].pte & PTE_FDIRTY;
+
+        if (v[n].dirty) {
+            KASSERT(v[n].slot == FRAME_NOSLOT);
+            dirty[ndirty++] = v[n];
+        }
+    }
+
+    if (ndirty > 0) {
+        swap_write_victims(dirty, ndirty);
+    }
+
+    for (unsigned i = 0, d = 0; i < n; i++) {
+        if (v[i].dirty) {
+            v[i].slot = dirty[d++].slot;
+            if (v[i].slot == FRAME_NOSLOT) {
+                frame_evict_done(v[i].paddr, false);
+                continue;
+            }
+            *v[i].pte = PTE_MKSWAP(v[i].slot) | v[i].fdirty;
+            swap_setowner(v[i].slot, v[i].as, v[i].vaddr);
+        } else {
+            KASSERT(v[i].slot != FRAME_NOSLOT || v[i].fdirty == 0);
+            *v[i].pte = (v[i].slot == FRAME_NOSLOT) ? PTE_DROPPED :
+                        PTE_MKSWAP(v[i].slot) | v[i].fdirty;
+            nclean++;
+        }
+        frame_evict_done(v[i].paddr, true);
+        frames[k++] = v[i].paddr;
+    }
+
+    spinlock_acquire(&swap_lock);
+    swap_stats.clean += nclean;
+    spinlock_release(&swap_lock);
+
+    return k;
+}
+
+/*
+ * Make room by paging out a victim, for a thread that found no free
+ * frame: the pageout thread didn't keep up, so it has to wait for the
+ * I/O itself.
+ */
+paddr_t
+swap_evict(void)
+{
+    paddr_t paddr;
+
+    if (swap_vnode == NULL) {
+        return 0;
+    }
+
+    spinlock_acquire(&swap_lock);
+    swap_stats.stalls++;
+    spinlock_release(&swap_lock);
+
+    swap_kick();
+    return swap_evict_batch(&paddr, 1) == 1 ? paddr : 0;
+}
+
+/*
+ * Wake the pageout thread, if there is one (alloc_kpages() calls this
+ * when free frames drop below SWAP_FREE_LOW).
+ */
+void
+swap_kick(void)
+{
+    if (swap_pageout_wchan == NULL) {
+        return;
+    }
+    spinlock_acquire(&swap_pageout_lock);
+    if (!swap_pageout_kicked) {
+        swap_pageout_kicked = true;
+        wchan_wakeone(swap_pageout_wchan, &swap_pageout_lock);
+    }
+    spinlock_release(&swap_pageout_lock);
+}
+
+/*
+ * The pageout thread. When kicked, it frees frames until there are
+ * SWAP_FREE_HIGH free, unused cached executable pages first and then
+ * SWAP_CLUSTER victims at a time.
+ */
+static void
+swap_pageout(void *data1, unsigned long data2)
+{
+    paddr_t frames[SWAP_CLUSTER];
+    unsigned n;
+
+    (void)data1;
+    (void)data2;
+
+    while (1) {
+        spinlock_acquire(&swap_pageout_lock);
+        while (!swap_pageout_kicked) {
+            wchan_sleep(swap_pageout_wchan, &swap_pageout_lock);
+        }
+        swap_pageout_kicked = false;
+        spinlock_release(&swap_pageout_lock);
+
+        spinlock_acquire(&swap_lock);
+        swap_stats.wakeups++;
+        spinlock_release(&swap_lock);
+
+        while (frame_nfree() < SWAP_FREE_HIGH) {
+            n = pagecache_reclaim(SWAP_CLUSTER);
+            if (n == 0) {
+                n = swap_evict_batch(frames, SWAP_CLUSTER);
+                if (n == 0) {
+                    // nothing we can evict, wait for the next kick
+                    break;
+                }
+                for (unsigned i = 0; i < n; i++) {
+                    free_kpages(PADDR_TO_KVADDR(frames[i]));
+                }
+            }
+
+            spinlock_acquire(&swap_lock);
+            swap_stats.background += n;
+            spinlock_release(&swap_lock);
+        }
+    }
+}
+
+void
+swap_printstats(void)
+{
+    uint32_t pageouts, clusters, pageins, reads, clean, used;
+    uint32_t wakeups, background, stalls;
+    uint32_t zstores, zloads, zrejects, zfull, zpages, zchunks, ratio;
+
+    if (swap_vnode == NULL) {
+        kprintf("Swap: disabled\n");
+        return;
+    }
+
+    spinlock_acquire(&swap_lock);
+    pageouts = swap_stats.pageouts;
+    clusters = swap_stats.clusters;
+    pageins = swap_stats.pageins;
+    reads = swap_stats.reads;
+    clean = swap_stats.clean;
+    wakeups = swap_stats.wakeups;
+    background = swap_stats.background;
+    stalls = swap_stats.stalls;
+    zstores = swap_stats.zstores;
+    zloads = swap_stats.zloads;
+    zrejects = swap_stats.zrejects;
+    zfull = swap_stats.zfull;
+    zpages = swap_stats.zpages;
+    zchunks = swap_stats.zchunks;
+    used = 0;
+    for (unsigned i = 0; i < swap_nslots; i++) {
+        if (swap_refs[i] > 0) {
+            used++;
+        }
+    }
+    spinlock_release(&swap_lock);
+
+    kprintf("Swap: %u/%u slots in use, %u page-outs in %u writes, %u page-ins in %u reads, "
+            "%u clean evictions\n",
+            used, swap_nslots, pageouts, clusters, pageins, reads, clean);
+    kprintf("Pageout: %u wakeups, %u frames freed in the background, "
+            "%u allocations stalled for direct reclaim (watermarks %u/%u)\n",
+            wakeups, background, stalls, SWAP_FREE_LOW, SWAP_FREE_HIGH);
+
+    if (swap_zpool == NULL) {
+        kprintf("Compressed swap: no pool\n");
+        return;
+    }
+    // pages held per page of pool they take up, in hundredths
+    ratio = zchunks ? zpages * (PAGE_SIZE / ZCHUNK) * 100 / zchunks : 0;
+    kprintf("Compressed swap: %u pages in %u/%u chunks (ratio %u.%02u), %u stored, %u loaded, "
+            "%u incompressible, %u found the pool full\n",
+            zpages, zchunks, ZCHUNKS, ratio / 100, ratio % 100,
+            zstores, zloads, zrejects, zfull);
+}
@@ -1,17 +1,619 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <thread.h>
+#include <cpu.h>
+#include <current.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <machine/tlb.h>
+#include <mips/trapframe.h>
+#include <platform/maxcpus.h>
 
 #include <proc.h>
 #include <elf.h>
 #include <spl.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <ksm.h>
+#include <uio.h>
+#include <vnode.h>
 
 /* Place your page table functions here */
 
+/*
+ * Reads of anonymous memory that has never been written map this one
+ * zero-filled frame read-only, and the first write to the page gets a
+ * frame of its own. The zero page holds an extra reference of its own,
+ * so it is never owned, paged out or freed.
+ */
+paddr_t vm_zeropage;
+
+/*
+ * Fault-around: after a fault, the other pages in the aligned window
+ * of this many pages around it that are already resident get TLB
+ * entries too, and untouched anonymous pages around a read fault get
+ * the zero page, so a scan takes one trap per window instead of one
+ * per page. A power of two up to VM_FAULTAROUND_MAX; 1 turns it off.
+ */
+static unsigned vm_faultaround = 8;
+
+static struct spinlock vm_stats_lock = SPINLOCK_INITIALIZER;
+static struct {
+    uint32_t zeromaps; // read faults given the zero page
+    uint32_t zerocopies; // writes that replaced it with a frame
+    uint32_t filereads; // pages read in from executables and file mappings
+    uint32_t filewrites; // pages of file mappings written back
+    uint32_t aroundhits; // neighbouring pages mapped by fault-around
+    uint32_t aroundmisses; // neighbouring pages it had to leave alone
+    uint32_t dropbehind; // pages behind sequential faults handed to the pager
+    uint32_t prefaults; // pages read in early for madvise(WILLNEED)
+    uint32_t swapahead; // pages read in from swap along with a faulting one
+    uint32_t swapaheadused; // those faulted on later
+    uint32_t stackgrows; // faults that grew a stack
+} vm_stats;
+
+/*
+ * TLB entries are tagged with the address space ID (ASID) of the
+ * address space they belong to, so switching address spaces only
+ * changes the current ASID instead of flushing the TLB. ASIDs are
+ * handed out in generations: when the 63 usable ones (0 means no
+ * address space) run out, a new generation starts and each address
+ * space takes a fresh ASID the next time it is activated. A cpu
+ * flushes its TLB when it first activates an address space of a new
+ * generation, since its TLB may still hold entries for old owners of
+ * the ASIDs.
+ *
+ * So entries of an address space outlive switches away from it, on
+ * every cpu it has run on (as->tlbcpus). Dropping one of its entries
+ * means sending a shootdown to each of those cpus and waiting for them
+ * all to answer (vm_tlb_invalidate()), so that by the time we go on to
+ * free or change the page, no cpu can use the old translation.
+ */
+#define NUM_ASID (TLBHI_PID / (1 << TLBHI_PID_SHIFT) + 1)
+
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_generation = 1; // 0 means never given an ASID
+static uint32_t asid_next = 1;
+
+// protects the counts of unanswered shootdowns (see vm_tlb_invalidate)
+static struct spinlock tlbshootdown_lock = SPINLOCK_INITIALIZER;
+
+// TLB statistics, protected by asid_lock
+static struct {
+    uint32_t switches; // activations that kept the TLB contents
+    uint32_t flushes; // activations that had to flush the TLB
+    uint32_t rollovers; // new ASID generations
+    uint32_t refills; // faults that only loaded a TLB entry
+    uint32_t shootdowns; // invalidations other cpus had to answer
+} tlb_stats;
+
+// flush this cpu's TLB, with interrupts off
+static void
+vm_tlb_flush(void)
+{
+    for (int i = 0; i < NUM_TLB; i++) {
+        tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    }
+}
+
+/*
+ * Make AS the address space the TLB translates for on this cpu,
+ * giving it an ASID if it has none in the current generation.
+ */
+void
+vm_tlb_activate(struct addrspace *as)
+{
+    int spl = splhigh();
+
+    spinlock_acquire(&asid_lock);
+    if (as->asid_gen != asid_generation) {
+        if (asid_next == NUM_ASID) {
+            // out of ASIDs, start again in a new generation
+            asid_generation++;
+            asid_next = 1;
+            tlb_stats.rollovers++;
+        }
+        as->asid = asid_next++;
+        as->asid_gen = asid_generation;
+
+        // no cpu will match entries under its old ASID again
+        as->tlbcpus = 0;
+    }
+    as->tlbcpus |= (uint32_t)1 << curcpu->c_number;
+    if (curcpu->c_asidgen != as->asid_gen) {
+        vm_tlb_flush();
+        curcpu->c_asidgen = as->asid_gen;
+        tlb_stats.flushes++;
+    } else {
+        tlb_stats.switches++;
+    }
+    spinlock_release(&asid_lock);
+
+    curcpu->c_asid = as->asid;
+    tlb_setasid(as->asid << TLBHI_PID_SHIFT);
+
+    // and the page table the refill fast path walks
+    cpupagetables[curcpu->c_number] = (vaddr_t)as->pagetable;
+
+    splx(spl);
+}
+
+/*
+ * Stop using every TLB entry of AS, on all cpus, by giving it a new
+ * ASID; its old entries are never matched again. Used when a lot of
+ * its entries lose permissions at once, by the process AS belongs to:
+ * a cpu still using the old ASID could only be running AS, which is
+ * running here.
+ */
+void
+vm_tlb_forget(struct addrspace *as)
+{
+    int spl = splhigh();
+
+    spinlock_acquire(&asid_lock);
+    as->asid_gen = 0;
+    spinlock_release(&asid_lock);
+
+    if (as == proc_getas()) {
+        vm_tlb_activate(as);
+    }
+
+    splx(spl);
+}
+
+/*
+ * Stop the TLB refill fast path from walking the page table of AS,
+ * which is about to be destroyed, on any cpu.
+ */
+void
+vm_tlb_deactivate(struct addrspace *as)
+{
+    int spl = splhigh();
+    for (unsigned i = 0; i < MAXCPUS; i++) {
+        if (cpupagetables[i] == (vaddr_t)as->pagetable) {
+            cpupagetables[i] = 0;
+        }
+    }
+    splx(spl);
+}
+
+/*
+ * Load a translation for the current address space into the TLB,
+ * replacing any entry already held for the same virtual page (e.g. a
+ * read-only entry being upgraded after a copy-on-write fault) so we
+ * never end up with duplicates.
+ */
+static void
+vm_tlb_load(vaddr_t vaddr, uint32_t elo)
+{
+    int index;
+
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    int spl = splhigh();
+    uint32_t ehi = (vaddr & TLBHI_VPAGE) | (curcpu->c_asid << TLBHI_PID_SHIFT);
+    index = tlb_probe(ehi, 0);
+    if (index >= 0) {
+        tlb_write(ehi, elo, index);
+    } else {
+        tlb_random(ehi, elo);
+    }
+    splx(spl);
+}
+
+// drop this cpu's TLB entry for the page TS names, with interrupts off
+static void
+vm_tlb_drop(const struct tlbshootdown *ts)
+{
+    int index;
+
+    if (ts->ts_asidgen == curcpu->c_asidgen) {
+        index = tlb_probe((ts->ts_vaddr & TLBHI_VPAGE) | (ts->ts_asid << TLBHI_PID_SHIFT), 0);
+        if (index >= 0) {
+            tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+        }
+        // the probe changed the current ASID
+        tlb_setasid(curcpu->c_asid << TLBHI_PID_SHIFT);
+    }
+}
+
+/*
+ * Drop the TLB entries for page VADDR of AS on every cpu that may hold
+ * one, and wait until they have. The caller must hold no spinlocks: a
+ * cpu spinning for one with interrupts off could not answer. While we
+ * wait we answer shootdowns sent to us, so two cpus can shoot at each
+ * other at once.
+ */
+void
+vm_tlb_invalidate(struct addrspace *as, vaddr_t vaddr)
+{
+    struct tlbshootdown ts;
+    volatile unsigned pending = 0;
+    uint32_t others;
+
+    int spl = splhigh();
+
+    spinlock_acquire(&asid_lock);
+    ts.ts_vaddr = vaddr;
+    ts.ts_asid = as->asid;
+    ts.ts_asidgen = as->asid_gen;
+    ts.ts_pending = &pending;
+    others = as->tlbcpus & ~((uint32_t)1 << curcpu->c_number);
+    spinlock_release(&asid_lock);
+
+    vm_tlb_drop(&ts);
+
+    if (others != 0) {
+        KASSERT(curcpu->c_spinlocks == 0);
+        for (unsigned i = 0; i < cpu_count(); i++) {
+            if (others & ((uint32_t)1 << i)) {
+                pending++;
+            }
+        }
+        for (unsigned i = 0; i < cpu_count(); i++) {
+            if (others & ((uint32_t)1 << i)) {
+                ipi_tlbshootdown(cpu_get(i), &ts);
+            }
+        }
+        while (pending > 0) {
+            interprocessor_interrupt();
+        }
+
+        spinlock_acquire(&asid_lock);
+        tlb_stats.shootdowns++;
+        spinlock_release(&asid_lock);
+    }
+
+    splx(spl);
+}
+
+/*
+ * Make the next use of page VADDR of AS fault into vm_fault(): flag
+ * the page table entry so the refill fast path leaves it alone, and
+ * drop the TLB entry. The pager uses this to see pages being used,
+ * and to keep a page still while it is paged out.
+ */
+void
+vm_tlb_trap(struct addrspace *as, vaddr_t vaddr)
+{
+    paddr_t *pte = &as->pagetable[PT_LVL1(vaddr)][PT_LVL2(vaddr)];
+
+    *pte |= PTE_TRAP;
+    vm_tlb_invalidate(as, vaddr);
+}
+
+/*
+ * Like vm_tlb_trap(), but only drop this cpu's TLB entry, for the clock
+ * hand, which holds the frame table lock and so can't wait for other
+ * cpus. Those may go on using the page unseen, which only makes it
+ * look idle; the pager traps it everywhere before paging it out.
+ */
+void
+vm_tlb_age(struct addrspace *as, vaddr_t vaddr)
+{
+    struct tlbshootdown ts;
+    paddr_t *pte = &as->pagetable[PT_LVL1(vaddr)][PT_LVL2(vaddr)];
+
+    *pte |= PTE_TRAP;
+
+    int spl = splhigh();
+    ts.ts_vaddr = vaddr;
+    ts.ts_asid = as->asid;
+    ts.ts_asidgen = as->asid_gen;
+    vm_tlb_drop(&ts);
+    splx(spl);
+}
+
+/*
+ * Handle the first write to a page mapped read-only in a writeable
+ * region. Either the page is shared copy-on-write or it is clean and
+ * we are tracking when it gets dirty. If we are the last user of the
+ * frame we can simply take it over, otherwise make a private copy and
+ * drop our reference to the shared one.
+ *
+ * The frame PTE refers to must be pinned, and on return whichever
+ * frame PTE now refers to is pinned instead.
+ */
+static int
+vm_copy_on_write(paddr_t *pte)
+{
+    paddr_t oldframe = *pte & PAGE_FRAME;
+
+    if (oldframe == vm_zeropage) {
+        // nothing to copy, and the zero page need not stay pinned
+        frame_unpin(oldframe);
+        vaddr_t zeroFrame = alloc_zeroed_kpage();
+        if (zeroFrame == 0) {
+            frame_pin_pte(pte);
+            return ENOMEM;
+        }
+        frame_setdirty(KVADDR_TO_PADDR(zeroFrame));
+        *pte = (KVADDR_TO_PADDR(zeroFrame) & PAGE_FRAME) | TLBLO_VALID | TLBLO_DIRTY;
+        frame_pin_pte(pte);
+
+        spinlock_acquire(&vm_stats_lock);
+        vm_stats.zerocopies++;
+        spinlock_release(&vm_stats_lock);
+        return 0;
+    }
+
+    if (frame_refcount(oldframe) == 1) {
+        frame_setdirty(oldframe);
+        *pte |= TLBLO_DIRTY;
+        return 0;
+    }
+
+    vaddr_t copyFrame = alloc_kpages(1);
+    if (copyFrame == 0) {
+        return ENOMEM;
+    }
+    memmove((void *)copyFrame, (const void *)PADDR_TO_KVADDR(oldframe), PAGE_SIZE);
+    frame_setdirty(KVADDR_TO_PADDR(copyFrame));
+
+    *pte = (KVADDR_TO_PADDR(copyFrame) & PAGE_FRAME) | TLBLO_VALID | TLBLO_DIRTY;
+    frame_unpin(oldframe);
+    free_kpages(PADDR_TO_KVADDR(oldframe));
+
+    // nobody else can see the new frame yet, so this cannot sleep
+    frame_pin_pte(pte);
+
+    return 0;
+}
+
+/*
+ * Check whether any of user page PAGE, in region R, is backed by a
+ * file. Regions are page aligned and never overlap, so R is the only
+ * region the page can be in.
+ */
+static bool
+vm_page_filebacked(region *r, vaddr_t page)
+{
+    return r->vnode != NULL && r->filebase < page + PAGE_SIZE &&
+           page < r->filebase + r->filesize;
+}
+
+/*
+ * Check whether user page PAGE can come from the page cache: it must
+ * be backed by a read-only region of an executable (not a file
+ * mapping, which may see the file change). If so, return the
+ * executable and the page's offset in it.
+ */
+static bool
+vm_page_shareable(region *r, vaddr_t page, struct vnode **v, off_t *offset)
+{
+    if (!vm_page_filebacked(r, page) || (r->flags & PF_W) == PF_W ||
+        r->mmapped) {
+        return false;
+    }
+
+    *v = r->vnode;
+    *offset = r->offset + ((off_t)page - (off_t)r->filebase);
+    return *offset >= 0 && *offset % PAGE_SIZE == 0;
+}
+
+/*
+ * Read the part of user page PAGE that comes from the executable
+ * backing region R into the zero filled frame at KVADDR.
+ */
+static int
+vm_read_file(region *r, vaddr_t page, vaddr_t kvaddr)
+{
+    vaddr_t start = page > r->filebase ? page : r->filebase;
+    vaddr_t end = page + PAGE_SIZE;
+    if (end > r->filebase + r->filesize) {
+        end = r->filebase + r->filesize;
+    }
+    KASSERT(start < end);
+
+    struct iovec iov;
+    struct uio u;
+    uio_kinit(&iov, &u, (void *)(kvaddr + (start - page)), end - start,
+              r->offset + (start - r->filebase), UIO_READ);
+    int result = VOP_READ(r->vnode, &u);
+    if (result) {
+        return result;
+    }
+    if (u.uio_resid != 0) {
+        // the file was checked at exec time, so it shrank since
+        return EIO;
+    }
+
+    spinlock_acquire(&vm_stats_lock);
+    vm_stats.filereads++;
+    spinlock_release(&vm_stats_lock);
+    return 0;
+}
+
+/*
+ * Read swap slot SLOT, for a fault on a page of region R of AS, into
+ * the frame at PADDR. The slots after it that hold other pages of AS,
+ * still out on swap, are read in the same I/O, as many as the window
+ * allows, and their pages mapped with PTE_AHEAD and PTE_TRAP set so
+ * vm_fault() sees whether they get used.
+ *
+ * The window is two pages, the faulting one and one more, grown to
+ * the next power of two above the read-ahead pages of AS used since
+ * its last read, up to SWAP_CLUSTER. Pages read ahead for nothing
+ * shrink it back. There is no read-ahead for a region advised to be
+ * used randomly, nor when it would cost pages paged out for it.
+ */
+static int
+vm_swap_in(struct addrspace *as, region *r, unsigned slot, paddr_t paddr)
+{
+    vaddr_t vaddrs[SWAP_CLUSTER - 1];
+    paddr_t paddrs[SWAP_CLUSTER];
+    paddr_t *ptes[SWAP_CLUSTER - 1];
+    unsigned window = 2, n = 0, k;
+
+    while (window < as->aheadused + 2 && window < SWAP_CLUSTER) {
+        window *= 2;
+    }
+    as->aheadused = 0;
+
+    if (r->advice != MADV_RANDOM) {
+        n = swap_cluster(slot, as, vaddrs, window - 1);
+    }
+
+    paddrs[0] = paddr;
+    for (k = 0; k < n; k++) {
+        // the owner recorded for the slot is only a hint
+        paddr_t *l2 = as->pagetable[PT_LVL1(vaddrs[k])];
+        if (l2 == NULL ||
+            (l2[PT_LVL2(vaddrs[k])] & ~PTE_FDIRTY) != PTE_MKSWAP(slot + 1 + k) ||
+            frame_nfree() <= SWAP_FREE_LOW) {
+            break;
+        }
+        vaddr_t kvaddr = alloc_kpages(1);
+        if (kvaddr == 0) {
+            break;
+        }
+        ptes[k] = &l2[PT_LVL2(vaddrs[k])];
+        paddrs[k + 1] = KVADDR_TO_PADDR(kvaddr);
+    }
+    n = k;
+
+    int result = swap_in(slot, paddrs, n + 1);
+
+    for (k = 0; k < n; k++) {
+        paddr_t frame = paddrs[k + 1];
+        paddr_t pte = *ptes[k];
+
+        // we slept for the read, so check nothing changed meanwhile
+        if (result || (pte & ~PTE_FDIRTY) != PTE_MKSWAP(slot + 1 + k)) {
+            free_kpages(PADDR_TO_KVADDR(frame));
+            continue;
+        }
+        *ptes[k] = frame | TLBLO_VALID | PTE_TRAP | PTE_AHEAD | (pte & PTE_FDIRTY);
+        frame_setslot(frame, slot + 1 + k);
+        frame_setowner(frame, as, vaddrs[k]);
+    }
+
+    if (result == 0 && n > 0) {
+        spinlock_acquire(&vm_stats_lock);
+        vm_stats.swapahead += n;
+        spinlock_release(&vm_stats_lock);
+    }
+    return result;
+}
+
+/*
+ * Bring in a page that is not resident: read it back from swap if it
+ * was paged out, from the executable if it has never been touched and
+ * is backed by one, otherwise hand out a fresh zero-filled frame.
+ * Either way the page starts out clean and mapped read-only, so the
+ * first write shows up as a fault. A clean page from the executable
+ * is simply dropped when paged out, and read again on the next fault.
+ */
+static int
+vm_page_in(struct addrspace *as, region *r, paddr_t *pte, vaddr_t page)
+{
+    struct vnode *v;
+    off_t offset;
+    bool shareable = (*pte & PTE_SWAPPED) == 0 &&
+                     vm_page_shareable(r, page, &v, &offset);
+
+    // read-only executable pages are shared through the page cache
+    if (shareable) {
+        paddr_t cached = pagecache_lookup(v, offset);
+        if (cached != 0) {
+            *pte = cached | TLBLO_VALID;
+            return 0;
+        }
+    }
+
+    // zero fill pages come from the pool zeroed while idle
+    vaddr_t virtualBase = (*pte & PTE_SWAPPED) ? alloc_kpages(1) : alloc_zeroed_kpage();
+    if (virtualBase == 0) {
+        return ENOMEM;
+    }
+    paddr_t physicalBase = KVADDR_TO_PADDR(virtualBase);
+
+    if ((*pte & PTE_SWAPPED) == 0 && vm_page_filebacked(r, page)) {
+        int result = vm_read_file(r, page, virtualBase);
+        if (result) {
+            free_kpages(virtualBase);
+            return result;
+        }
+    }
+
+    if (*pte & PTE_SWAPPED) {
+        unsigned slot = PTE_SLOT(*pte);
+        int result = vm_swap_in(as, r, slot, physicalBase);
+        if (result) {
+            free_kpages(virtualBase);
+            return result;
+        }
+        // keep the swap copy until the page is written, so a clean
+        // page can be evicted again without writing it out
+        frame_setslot(physicalBase, slot);
+    }
+
+    if (shareable) {
+        physicalBase = pagecache_insert(v, offset, physicalBase);
+    }
+
+    *pte = (physicalBase & PAGE_FRAME) | TLBLO_VALID | (*pte & PTE_FDIRTY);
+    return 0;
+}
+
+/*
+ * Write page PAGE of the file mapping R in AS back to the file, if it
+ * was written since it was last written back. The page is made
+ * read-only first, so the next write to it shows up as a fault and
+ * marks it again.
+ */
+int
+vm_writeback(struct addrspace *as, region *r, vaddr_t page)
+{
+    KASSERT(r->mmapped && r->vnode != NULL);
+
+    paddr_t *l2 = as->pagetable[PT_LVL1(page)];
+    if (l2 == NULL || (l2[PT_LVL2(page)] & PTE_FDIRTY) == 0) {
+        return 0;
+    }
+    paddr_t *pte = &l2[PT_LVL2(page)];
+
+    // a page written out to swap has to come back to be written
+    while (!frame_pin_pte(pte)) {
+        int result = vm_page_in(as, r, pte, page);
+        if (result) {
+            return result;
+        }
+    }
+    *pte &= ~TLBLO_DIRTY;
+    vm_tlb_invalidate(as, page);
+
+    paddr_t frame = *pte & PAGE_FRAME;
+    int result = 0;
+
+    // only the part of the page that came from the file goes back
+    vaddr_t start = page > r->filebase ? page : r->filebase;
+    vaddr_t end = page + PAGE_SIZE;
+    if (end > r->filebase + r->filesize) {
+        end = r->filebase + r->filesize;
+    }
+    if (start < end) {
+        struct iovec iov;
+        struct uio u;
+        uio_kinit(&iov, &u, (void *)(PADDR_TO_KVADDR(frame) + (start - page)),
+                  end - start, r->offset + (start - r->filebase), UIO_WRITE);
+        result = VOP_WRITE(r->vnode, &u);
+        // the file may be an executable with pages in the cache
+        pagecache_invalidate(r->vnode);
+    }
+    if (result == 0) {
+        *pte &= ~PTE_FDIRTY;
+
+        spinlock_acquire(&vm_stats_lock);
+        vm_stats.filewrites++;
+        spinlock_release(&vm_stats_lock);
+    }
+
+    frame_setowner(frame, as, page);
+    frame_unpin(frame);
+    return result;
+}
 
 void vm_bootstrap(void)
 {
@@ -20,16 +622,197 @@ void vm_bootstrap(void)
      * You may or may not need to add anything here depending what's
      * provided or required by the assignment spec.
      */
+    frametable_bootstrap();
+
+    vaddr_t zero = alloc_zeroed_kpage();
+    if (zero == 0) {
+        panic("vm: no memory for the zero page\n");
+    }
+    vm_zeropage = KVADDR_TO_PADDR(zero);
+    frame_incref(vm_zeropage);
+
+    swap_bootstrap();
+    as_bootstrap();
+    ksm_bootstrap();
+}
+
+/*
+ * Return the page table entry for VADDR in AS, making its level 2
+ * table if it has none yet. Returns NULL if out of memory.
+ *
+ * Whoever makes a zero entry non-zero counts it in as->ptcount, so
+ * as_unmap() knows when the table is empty and can free it.
+ */
+static paddr_t *
+vm_getpte(struct addrspace *as, vaddr_t vaddr)
+{
+    unsigned i = PT_LVL1(vaddr);
+
+    if (as->pagetable[i] == NULL) {
+        paddr_t *l2 = kmalloc(1024 * sizeof(paddr_t));
+        if (l2 == NULL) {
+            return NULL;
+        }
+        for (int j = 0; j < 1024; j++) {
+            l2[j] = 0;
+        }
+        as->pagetable[i] = l2;
+        as->ptcount[i] = 0;
+        as->ptmap[i / 32] |= PT_MAPBIT(i);
+    }
+    return &as->pagetable[i][PT_LVL2(vaddr)];
 }
 
+/*
+ * Read page PAGE of region R of AS in now, ahead of its first use, if
+ * it has to come from swap or a file; untouched anonymous pages cost
+ * nothing to fault in later. No TLB entry is loaded.
+ */
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+vm_prefault(struct addrspace *as, region *r, vaddr_t page)
 {
-    // if faulttype == VM_FAULT_READONLY then return EFAULT
-    if (faulttype == VM_FAULT_READONLY){
-        return EFAULT;
+    paddr_t *pte = vm_getpte(as, page);
+    if (pte == NULL) {
+        return ENOMEM;
+    }
+    if (PTE_EMPTY(*pte) && !vm_page_filebacked(r, page)) {
+        return 0;
+    }
+
+    bool fresh = *pte == 0;
+    bool resident = true;
+    while (!frame_pin_pte(pte)) {
+        resident = false;
+        int result = vm_page_in(as, r, pte, page);
+        if (result) {
+            return result;
+        }
+    }
+
+    if (fresh) {
+        as->ptcount[PT_LVL1(page)]++;
+    }
+
+    paddr_t frame = *pte & PAGE_FRAME;
+    frame_setowner(frame, as, page);
+    frame_unpin(frame);
+
+    if (!resident) {
+        spinlock_acquire(&vm_stats_lock);
+        vm_stats.prefaults++;
+        spinlock_release(&vm_stats_lock);
+    }
+    return 0;
+}
+
+/*
+ * Set the fault-around window to NPAGES pages.
+ */
+int
+vm_set_faultaround(unsigned npages)
+{
+    if (npages == 0 || npages > VM_FAULTAROUND_MAX ||
+        (npages & (npages - 1)) != 0) {
+        return EINVAL;
+    }
+    vm_faultaround = npages;
+    return 0;
+}
+
+/*
+ * Map the neighbours of page FAULTPAGE, in region R, that are cheap
+ * to map, after a fault of type FAULTTYPE.
+ * Pages not resident are left to fault as usual, and so are pages the
+ * pager is watching (PTE_TRAP), so their use is still seen. Interrupts
+ * stay off from looking at each entry until it is in the TLB. So the
+ * pager can't run here in between, and a pager on another cpu, which
+ * traps the entry and then waits for our answer to its shootdown,
+ * only gets it once the entry is in the TLB, and the shootdown drops
+ * it again.
+ *
+ * A region advised to be used sequentially gets the largest window,
+ * and the window behind the fault goes to the pager first.
+ */
+static void
+vm_fault_around(struct addrspace *as, region *r, vaddr_t faultpage, int faulttype)
+{
+    bool sequential = r->advice == MADV_SEQUENTIAL;
+    vaddr_t winsize = (sequential ? VM_FAULTAROUND_MAX : vm_faultaround) * PAGE_SIZE;
+    vaddr_t start = faultpage & ~(winsize - 1);
+    vaddr_t end = start + winsize;
+    uint32_t hits = 0, misses = 0, dropped = 0;
+
+    // stay inside the region and the level 2 table
+    vaddr_t lo = r->base;
+    vaddr_t hi = r->base + r->size;
+    if (start < lo) {
+        start = lo;
+    }
+    if (end > hi || end == 0) {
+        end = hi;
+    }
+
+    paddr_t *pt = as->pagetable[PT_LVL1(faultpage)];
+
+    int spl = splhigh();
+    for (vaddr_t page = start; page < end; page += PAGE_SIZE) {
+        if (page == faultpage) {
+            continue;
+        }
+        paddr_t *pte = &pt[PT_LVL2(page)];
+
+        if (PTE_EMPTY(*pte) && faulttype == VM_FAULT_READ &&
+            !vm_page_filebacked(r, page)) {
+            if (*pte == 0) {
+                as->ptcount[PT_LVL1(page)]++;
+            }
+            *pte = vm_zeropage | TLBLO_VALID;
+        }
+        if ((*pte & (TLBLO_VALID | PTE_TRAP)) != TLBLO_VALID) {
+            misses++;
+            continue;
+        }
+        vm_tlb_load(page, *pte);
+        hits++;
+    }
+    splx(spl);
+
+    // a sequential scan won't be back for the window before this
+    // one, so let the pager have it first; pinning may sleep, so this
+    // runs with interrupts back on
+    if (sequential && start >= lo + winsize) {
+        for (vaddr_t page = start - winsize; page < start; page += PAGE_SIZE) {
+            paddr_t *l2 = as->pagetable[PT_LVL1(page)];
+            if (l2 == NULL) {
+                continue;
+            }
+            paddr_t *pte = &l2[PT_LVL2(page)];
+            if ((*pte & (TLBLO_VALID | PTE_TRAP)) != TLBLO_VALID ||
+                PTE_ZEROPAGE(*pte)) {
+                continue;
+            }
+            // keep the pager and page merger off the entry while we
+            // change it
+            if (!frame_pin_pte(pte)) {
+                continue;
+            }
+            frame_deactivate(*pte & PAGE_FRAME);
+            vm_tlb_trap(as, page);
+            frame_unpin(*pte & PAGE_FRAME);
+            dropped++;
+        }
     }
 
+    spinlock_acquire(&vm_stats_lock);
+    vm_stats.aroundhits += hits;
+    vm_stats.aroundmisses += misses;
+    vm_stats.dropbehind += dropped;
+    spinlock_release(&vm_stats_lock);
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
     // load the address space
 	struct addrspace *as;
 
@@ -43,74 +826,200 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
-    // test that the faultaddress falls within a defined region
-    uint32_t isDirty = 0;
-	region *found_region = as->regions;
-	while (found_region != NULL) {
-        if(found_region->base <= faultaddress && faultaddress < found_region->base + found_region->size){
-            if ((found_region->flags & PF_W) == PF_W) {
-                isDirty = TLBLO_DIRTY;
-            }
-            break;
-        }
-        found_region = found_region->next;
-	}
-
-    // test that we found a region faultaddress falls within
-    if(found_region == NULL){
-        if (!(faultaddress < as->stack && faultaddress > (as->stack - 16 * PAGE_SIZE))) {
+    // test that the faultaddress falls within a defined region, or
+    // just below the stack, which then grows down to cover it
+	region *found_region = as_find_region(as, faultaddress);
+    if (found_region == NULL) {
+        found_region = as_grow_stack(as, faultaddress);
+        if (found_region == NULL) {
             return EFAULT;
         }
 
-        // else we're in the stack, so set the dirtybit
+        spinlock_acquire(&vm_stats_lock);
+        vm_stats.stackgrows++;
+        spinlock_release(&vm_stats_lock);
+    }
+
+    uint32_t isDirty = 0;
+    if ((found_region->flags & PF_W) == PF_W) {
         isDirty = TLBLO_DIRTY;
     }
 
-    // load level 1 index, level 2 index, and the offset
-    vaddr_t lvl1_index = faultaddress >> 22;
-    vaddr_t lvl2_index = (faultaddress << 10) >> 22;
+    // mprotect can take away all access to a region
+    if ((found_region->flags & (PF_R | PF_W)) == 0) {
+        return EFAULT;
+    }
+
+    // a write to a read-only page is only legal if the region is
+    // writeable, in which case the page is shared copy-on-write, or if
+    // the loader is writing: the refill fast path may have reloaded the
+    // entry without the forced dirty bit, so load it again with it
+    if (faulttype == VM_FAULT_READONLY && isDirty == 0 && as->loadingbit == 0) {
+        return EFAULT;
+    }
+
+    // find the page table entry, making the level 2 table if need be
+    paddr_t *pte = vm_getpte(as, faultaddress);
+    if (pte == NULL) {
+        return ENOMEM;
+    }
+
+    bool fresh = *pte == 0;
 
-    // test if page table entry is invalid, if so malloc it
-    if(as->pagetable[lvl1_index] == NULL){
-        as->pagetable[lvl1_index] = kmalloc(1024 * sizeof(paddr_t));
+    // reading a page that was never written: map the zero page and
+    // leave allocating a frame to the first write (but not while
+    // loading, which writes through forced writeable entries)
+    if (PTE_EMPTY(*pte) && faulttype == VM_FAULT_READ && as->loadingbit == 0 &&
+        !vm_page_filebacked(found_region, faultaddress & PAGE_FRAME)) {
+        *pte = vm_zeropage | TLBLO_VALID;
 
-        for(int i = 0; i < 1024; i++){
-            as->pagetable[lvl1_index][i] = 0;
+        spinlock_acquire(&vm_stats_lock);
+        vm_stats.zeromaps++;
+        spinlock_release(&vm_stats_lock);
+    }
+
+    // a page that is resident and valid only needed its TLB entry
+    if (faulttype != VM_FAULT_READONLY && (*pte & TLBLO_VALID)) {
+        spinlock_acquire(&asid_lock);
+        tlb_stats.refills++;
+        spinlock_release(&asid_lock);
+    }
+
+    // make sure the page is resident, and pin it so the pager
+    // can't take it away until it is in the TLB
+    while (!frame_pin_pte(pte)) {
+        int result = vm_page_in(as, found_region, pte, faultaddress & PAGE_FRAME);
+        if (result) {
+            return result;
         }
     }
+    if (fresh) {
+        as->ptcount[PT_LVL1(faultaddress)]++;
+    }
 
-    // test if page is not defined, if so malloc it and initialize it to zero
-    if(as->pagetable[lvl1_index][lvl2_index] == 0){
+    // writing to a writeable region through a read-only entry means the
+    // frame is shared copy-on-write or clean, so break the sharing and
+    // mark it dirty before the entry goes into the TLB (this also saves
+    // a second trap on a write miss). The loader must not write
+    // through to the zero page either.
+    if (((faulttype != VM_FAULT_READ && isDirty) ||
+         (as->loadingbit && PTE_ZEROPAGE(*pte))) && (*pte & TLBLO_DIRTY) == 0) {
+        int result = vm_copy_on_write(pte);
+        if (result) {
+            frame_unpin(*pte & PAGE_FRAME);
+            return result;
+        }
+    }
 
-        // used to keep track of whether the region is write protected or not
-        // finally we setup the page
-        vaddr_t virtualBase = alloc_kpages(1);
-        bzero((void *)virtualBase, PAGE_SIZE);
-        paddr_t physicalBase = KVADDR_TO_PADDR(virtualBase);
-        as->pagetable[lvl1_index][lvl2_index] = (physicalBase & PAGE_FRAME) | TLBLO_VALID | isDirty;
+    // a write to a file mapping has to go back to the file sometime
+    if (faulttype != VM_FAULT_READ && isDirty &&
+        found_region->mmapped && found_region->vnode != NULL &&
+        !found_region->forked) {
+        *pte |= PTE_FDIRTY;
     }
 
-    // load it into the TLB and then return
-    uint32_t ehi, elo;
-    ehi = faultaddress & TLBHI_VPAGE;
-    elo = as->pagetable[lvl1_index][lvl2_index] | as->loadingbit;
+    // the loader writes through a forced writeable entry, which we
+    // would not otherwise see
+    if (as->loadingbit && (*pte & TLBLO_DIRTY) == 0) {
+        frame_setdirty(*pte & PAGE_FRAME);
+    }
 
-    /* Disable interrupts on this CPU while frobbing the TLB. */
-	int spl = splhigh();
-    tlb_random(ehi, elo);
-	splx(spl);
+    // map the neighbours first, so their TLB entries can't push this
+    // one out; the loader's forced writeable entries are one at a time
+    if (vm_faultaround > 1 && as->loadingbit == 0 &&
+        found_region->advice != MADV_RANDOM) {
+        vm_fault_around(as, found_region, faultaddress & PAGE_FRAME, faulttype);
+    }
+
+    // a page read ahead from swap turned out to be wanted
+    if (*pte & PTE_AHEAD) {
+        *pte &= ~PTE_AHEAD;
+        as->aheadused++;
+
+        spinlock_acquire(&vm_stats_lock);
+        vm_stats.swapaheadused++;
+        spinlock_release(&vm_stats_lock);
+    }
+
+    // load it into the TLB and then return; later misses on it can
+    // take the refill fast path again
+    *pte &= ~PTE_TRAP;
+    vm_tlb_load(faultaddress, *pte | as->loadingbit);
+
+    // the frame is ours alone again (or still shared), let the pager know
+    paddr_t frame = *pte & PAGE_FRAME;
+    frame_setowner(frame, as, faultaddress);
+    frame_unpin(frame);
 
     return 0;
 }
 
+/*
+ * Print VM statistics (kernel menu).
+ */
+void
+vm_printstats(void)
+{
+    uint32_t zeromaps, zerocopies, filereads, filewrites, aroundhits, aroundmisses;
+    uint32_t dropbehind, prefaults, stackgrows, swapahead, swapaheadused;
+    uint32_t switches, flushes, rollovers, refills, shootdowns;
+
+    spinlock_acquire(&vm_stats_lock);
+    zeromaps = vm_stats.zeromaps;
+    zerocopies = vm_stats.zerocopies;
+    filereads = vm_stats.filereads;
+    filewrites = vm_stats.filewrites;
+    aroundhits = vm_stats.aroundhits;
+    aroundmisses = vm_stats.aroundmisses;
+    dropbehind = vm_stats.dropbehind;
+    prefaults = vm_stats.prefaults;
+    stackgrows = vm_stats.stackgrows;
+    swapahead = vm_stats.swapahead;
+    swapaheadused = vm_stats.swapaheadused;
+    spinlock_release(&vm_stats_lock);
+
+    spinlock_acquire(&asid_lock);
+    switches = tlb_stats.switches;
+    flushes = tlb_stats.flushes;
+    rollovers = tlb_stats.rollovers;
+    refills = tlb_stats.refills;
+    shootdowns = tlb_stats.shootdowns;
+    spinlock_release(&asid_lock);
+
+    frame_printstats();
+    swap_printstats();
+    pagecache_printstats();
+    ksm_printstats();
+    kprintf("Zero page: %u read faults mapped it, %u of those pages written since\n",
+            zeromaps, zerocopies);
+    kprintf("Files: %u pages read in on demand, %u pages of mappings written back\n",
+            filereads, filewrites);
+    kprintf("Fault-around: %u-page window, %u neighbours mapped, %u left to fault\n",
+            vm_faultaround, aroundhits, aroundmisses);
+    kprintf("Swap read-ahead: %u pages read in with faulting ones, %u of them used\n",
+            swapahead, swapaheadused);
+    kprintf("Stacks: grown by %u faults\n", stackgrows);
+    kprintf("Advice: %u pages behind sequential faults given up, %u pages read in early\n",
+            dropbehind, prefaults);
+    kprintf("TLB: %u refills, %u switches kept the TLB (up to %u refills each), %u flushes, %u ASID rollovers, "
+            "%u shootdowns\n",
+            refills, switches, NUM_TLB, flushes, rollovers, shootdowns);
+}
+
 /*
  * SMP-specific functions.  Unused in our UNSW configuration.
  */
 
+/*
+ * Answer a shootdown from vm_tlb_invalidate() on another cpu.
+ */
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
+    vm_tlb_drop(ts);
+
+    spinlock_acquire(&tlbshootdown_lock);
+    (*ts->ts_pending)--;
+    spinlock_release(&tlbshootdown_lock);
 }
 
@@ -141,6 +141,7 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(__intptr_t change);
+pid_t vfork(void);
 ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
@@ -170,4 +171,14 @@ time_t time(time_t *seconds);			/* calls __time */
 void *mmap(size_t length, int prot, int fd, off_t offset);
 int munmap(void *addr);
 
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED 3
+#define MADV_DONTNEED 4
+
+int mprotect(void *addr, size_t length, int prot);
+int madvise(void *addr, size_t length, int advice);
+int mincore(void *addr, size_t length, char *vec);
+
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,148 @@
+/*
+ * cowtest - check that fork shares pages copy-on-write correctly.
+ *
+ * Fills an array spanning many pages, then forks children (and a
+ * grandchild) that each overwrite part of it and check that they see
+ * their own writes and the parent's data everywhere else. The parent
+ * checks its own copy is untouched after each child, and that writing
+ * its pages once they are no longer shared still works.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 64
+#define NCHILDREN 4
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+
+static unsigned data[NPAGES][WORDS];
+
+static
+void
+fill(unsigned page, unsigned tag)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		data[page][i] = tag * NPAGES * WORDS + page * WORDS + i;
+	}
+}
+
+static
+int
+check(unsigned page, unsigned tag)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		if (data[page][i] != tag * NPAGES * WORDS + page * WORDS + i) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Child number N (from 1) writes every page P with P % NCHILDREN equal
+ * to N - 1, and checks all pages. If NEST is set it forks a child of
+ * its own that does the same one level down first.
+ */
+static
+void
+child(unsigned n, int nest)
+{
+	unsigned p;
+	pid_t pid;
+	int status;
+
+	for (p = 0; p < NPAGES; p++) {
+		if (p % NCHILDREN == n - 1) {
+			fill(p, n);
+		}
+	}
+
+	if (nest) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			for (p = 0; p < NPAGES; p++) {
+				fill(p, n + NCHILDREN);
+			}
+			for (p = 0; p < NPAGES; p++) {
+				if (!check(p, n + NCHILDREN)) {
+					errx(1, "FAILED: grandchild page %u", p);
+				}
+			}
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			_exit(1);
+		}
+	}
+
+	for (p = 0; p < NPAGES; p++) {
+		if (!check(p, p % NCHILDREN == n - 1 ? n : 0)) {
+			errx(1, "FAILED: child %u page %u", n, p);
+		}
+	}
+	_exit(0);
+}
+
+int
+main(void)
+{
+	unsigned n, p;
+	pid_t pid;
+	int status;
+
+	for (p = 0; p < NPAGES; p++) {
+		fill(p, 0);
+	}
+
+	for (n = 1; n <= NCHILDREN; n++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			child(n, n == NCHILDREN);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "FAILED: child %u failed", n);
+		}
+		for (p = 0; p < NPAGES; p++) {
+			if (!check(p, 0)) {
+				errx(1, "FAILED: child %u changed parent page %u",
+				     n, p);
+			}
+		}
+	}
+	printf("Passed copy-on-write isolation test.\n");
+
+	/* the children are gone, so these writes take the pages back */
+	for (p = 0; p < NPAGES; p++) {
+		fill(p, 1);
+	}
+	for (p = 0; p < NPAGES; p++) {
+		if (!check(p, 1)) {
+			errx(1, "FAILED: parent page %u after children", p);
+		}
+	}
+	printf("Passed unshared write test.\n");
+
+	printf("cowtest done.\n");
+	return 0;
+}
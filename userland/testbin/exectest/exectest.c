@@ -0,0 +1,108 @@
+/*
+ * exectest - check that exec sees an executable's current contents.
+ *
+ * Copies /bin/true to a scratch file and runs it a few times at once,
+ * so later runs share its cached pages, then overwrites the file with
+ * /bin/false and checks the next run fails, and back again.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <err.h>
+
+#define SCRATCH "exectest.tmp"
+#define NRUNS 4
+
+static
+void
+copy(const char *from, const char *to)
+{
+	char buf[1024];
+	int in, out;
+	ssize_t len;
+
+	in = open(from, O_RDONLY);
+	if (in < 0) {
+		err(1, "%s", from);
+	}
+	out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (out < 0) {
+		err(1, "%s", to);
+	}
+	while ((len = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, len) != len) {
+			err(1, "%s: write", to);
+		}
+	}
+	if (len < 0) {
+		err(1, "%s: read", from);
+	}
+	close(in);
+	close(out);
+}
+
+static
+pid_t
+start(void)
+{
+	char *args[2];
+	pid_t pid;
+
+	args[0] = (char *)SCRATCH;
+	args[1] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv(SCRATCH, args);
+		err(1, "%s", SCRATCH);
+	}
+	return pid;
+}
+
+/*
+ * Run the scratch file NRUNS times at once and check each run exits
+ * with STATUS.
+ */
+static
+void
+run(int status, const char *what)
+{
+	pid_t pids[NRUNS];
+	int i, got;
+
+	for (i = 0; i < NRUNS; i++) {
+		pids[i] = start();
+	}
+	for (i = 0; i < NRUNS; i++) {
+		if (waitpid(pids[i], &got, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(got) || WEXITSTATUS(got) != status) {
+			remove(SCRATCH);
+			errx(1, "FAILED: %s", what);
+		}
+	}
+}
+
+int
+main(void)
+{
+	copy("/bin/true", SCRATCH);
+	run(0, "copy of /bin/true failed");
+	printf("Passed shared exec test.\n");
+
+	copy("/bin/false", SCRATCH);
+	run(1, "exec ran the old contents after overwriting with /bin/false");
+	copy("/bin/true", SCRATCH);
+	run(0, "exec ran the old contents after overwriting with /bin/true");
+	printf("Passed overwrite test.\n");
+
+	remove(SCRATCH);
+	printf("exectest done.\n");
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * heaptest - stress growing and shrinking the heap with sbrk.
+ *
+ * Grows the heap a page at a time and in large steps, writing every
+ * page, then shrinks it part way and grows it again many times over.
+ * Pages the heap shrank away from must come back zero filled, and the
+ * pages it kept must keep their contents. Also checks that the heap
+ * can't shrink below where it started or grow absurdly large.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 256
+#define ROUNDS 20
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+
+static unsigned *base;
+
+static
+void *
+dosbrk(intptr_t amount)
+{
+	void *p;
+
+	p = sbrk(amount);
+	if (p == (void *)-1) {
+		err(1, "sbrk(%ld)", (long)amount);
+	}
+	return p;
+}
+
+static
+void
+fill(unsigned page, unsigned tag)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		base[page * WORDS + i] = tag + i;
+	}
+}
+
+static
+void
+check(unsigned page, unsigned tag, const char *what)
+{
+	unsigned i, want;
+
+	for (i = 0; i < WORDS; i++) {
+		want = tag == 0 ? 0 : tag + i;
+		if (base[page * WORDS + i] != want) {
+			errx(1, "FAILED: %s: page %u word %u is %u, "
+			     "expected %u", what, page, i,
+			     base[page * WORDS + i], want);
+		}
+	}
+}
+
+int
+main(void)
+{
+	unsigned p, r, keep;
+	void *start;
+
+	/* start on a page boundary */
+	start = dosbrk(0);
+	dosbrk(PAGE_SIZE - (uintptr_t)start % PAGE_SIZE);
+	base = dosbrk(0);
+
+	for (p = 0; p < NPAGES / 2; p++) {
+		dosbrk(PAGE_SIZE);
+		fill(p, p + 1);
+	}
+	dosbrk((NPAGES / 2) * PAGE_SIZE);
+	for (p = NPAGES / 2; p < NPAGES; p++) {
+		check(p, 0, "new heap page");
+		fill(p, p + 1);
+	}
+	for (p = 0; p < NPAGES; p++) {
+		check(p, p + 1, "grown heap");
+	}
+	printf("Passed heap growth test.\n");
+
+	for (r = 0; r < ROUNDS; r++) {
+		keep = (r * 37) % NPAGES;
+		dosbrk(-(intptr_t)(NPAGES - keep) * PAGE_SIZE);
+		dosbrk((NPAGES - keep) * PAGE_SIZE);
+		for (p = 0; p < keep; p++) {
+			check(p, p + 1, "kept heap page");
+		}
+		for (p = keep; p < NPAGES; p++) {
+			check(p, 0, "regrown heap page");
+			fill(p, p + 1);
+		}
+	}
+	printf("Passed heap shrink test.\n");
+
+	if (sbrk(-(intptr_t)(NPAGES + 16) * PAGE_SIZE) != (void *)-1) {
+		errx(1, "FAILED: heap shrank below its start");
+	}
+	if (sbrk(0x40000000) != (void *)-1 || errno != ENOMEM) {
+		errx(1, "FAILED: heap grew by 1G");
+	}
+	printf("Passed heap limit test.\n");
+
+	dosbrk(-(intptr_t)NPAGES * PAGE_SIZE);
+	printf("heaptest done.\n");
+	return 0;
+}
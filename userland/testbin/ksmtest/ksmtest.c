@@ -0,0 +1,134 @@
+/*
+ * ksmtest - check that merged pages stay private.
+ *
+ * Fills many pages with only a few different contents, some of them
+ * all zeroes, in two processes, and waits long enough for the kernel
+ * to merge them. Then each process writes its own data to some of the
+ * pages, which must not show up in any other page or in the other
+ * process, and checks every page.
+ *
+ * Turn merging on first (ksm on at the kernel menu), or this just
+ * checks ordinary memory.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 128
+#define NKINDS 4	/* different contents; kind 0 is all zeroes */
+#define WAIT 5		/* seconds; the kernel scans every 2 */
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+
+static unsigned pages[NPAGES][WORDS];
+
+static
+unsigned
+expected(unsigned p, unsigned i, unsigned tag)
+{
+	unsigned kind = p % NKINDS;
+
+	if (tag != 0 && p % 3 == 0) {
+		return tag * 100000 + p * WORDS + i;
+	}
+	return kind == 0 ? 0 : kind * 1000 + i;
+}
+
+static
+void
+fill(unsigned tag)
+{
+	unsigned p, i;
+
+	for (p = 0; p < NPAGES; p++) {
+		if (tag != 0 && p % 3 != 0) {
+			continue;
+		}
+		for (i = 0; i < WORDS; i++) {
+			pages[p][i] = expected(p, i, tag);
+		}
+	}
+}
+
+static
+void
+check(unsigned tag, const char *what)
+{
+	unsigned p, i;
+
+	for (p = 0; p < NPAGES; p++) {
+		for (i = 0; i < WORDS; i++) {
+			if (pages[p][i] != expected(p, i, tag)) {
+				errx(1, "FAILED: %s: page %u word %u is %u, "
+				     "expected %u", what, p, i, pages[p][i],
+				     expected(p, i, tag));
+			}
+		}
+	}
+}
+
+static
+void
+wait_for_merging(void)
+{
+	time_t start;
+
+	start = time(NULL);
+	while (time(NULL) < start + WAIT) {
+		/* spin */
+	}
+}
+
+/*
+ * Give the pages their few contents, let them be merged, then write
+ * to some of them as process TAG.
+ */
+static
+void
+run(unsigned tag)
+{
+	unsigned p;
+
+	/* write the zero pages too, so they have frames of their own */
+	for (p = 0; p < NPAGES; p++) {
+		pages[p][0] = 1;
+	}
+	fill(0);
+	wait_for_merging();
+	check(0, "after merging");
+
+	fill(tag);
+	check(tag, "after writing merged pages");
+	wait_for_merging();
+	check(tag, "after merging again");
+}
+
+int
+main(void)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	run(pid == 0 ? 2 : 1);
+	if (pid == 0) {
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child failed");
+	}
+	printf("Passed merged page test.\n");
+
+	printf("ksmtest done.\n");
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * mincoretest - check mincore().
+ *
+ * Maps some anonymous memory, writes to every other page, and checks
+ * that mincore() reports just those pages resident, and that a page
+ * given back with MADV_DONTNEED is reported as not resident.
+ *
+ * Run it when memory isn't short, or pages may be paged out under it.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 8
+
+static
+void
+check(char *p, const char *expect, const char *when)
+{
+	char vec[NPAGES];
+	unsigned i;
+
+	if (mincore(p, NPAGES * PAGE_SIZE, vec) < 0) {
+		err(1, "mincore");
+	}
+	for (i = 0; i < NPAGES; i++) {
+		if (vec[i] != expect[i] - '0') {
+			errx(1, "FAILED: %s, page %u reported %s", when, i,
+			     vec[i] ? "resident" : "not resident");
+		}
+	}
+}
+
+int
+main(void)
+{
+	char vec[1];
+	char *p;
+	unsigned i;
+
+	p = mmap(NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE, -1, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	check(p, "00000000", "before touching");
+
+	for (i = 0; i < NPAGES; i += 2) {
+		p[i * PAGE_SIZE] = 'm';
+	}
+	check(p, "10101010", "after writing");
+
+	if (madvise(p, PAGE_SIZE, MADV_DONTNEED) < 0) {
+		err(1, "madvise");
+	}
+	check(p, "00101010", "after MADV_DONTNEED");
+
+	if (mincore(p + 1, PAGE_SIZE, vec) == 0 || errno != EINVAL) {
+		errx(1, "FAILED: unaligned address did not fail with EINVAL");
+	}
+	if (mincore(p, (size_t)-1, vec) == 0 || errno != ENOMEM) {
+		errx(1, "FAILED: length wrapping around did not fail "
+		     "with ENOMEM");
+	}
+	if (munmap(p) < 0) {
+		err(1, "munmap");
+	}
+	if (mincore(p, PAGE_SIZE, vec) == 0 || errno != ENOMEM) {
+		errx(1, "FAILED: unmapped page did not fail with ENOMEM");
+	}
+
+	printf("mincoretest done.\n");
+	return 0;
+}
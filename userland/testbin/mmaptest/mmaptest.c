@@ -0,0 +1,251 @@
+/*
+ * mmaptest - check mmap() and munmap().
+ *
+ * Maps anonymous memory and checks it starts out zero and keeps what
+ * is written to it, maps a file and checks it shows the file and that
+ * writes to it reach the file by the time it is unmapped, and checks
+ * that unmapped memory can't be touched any more. Also checks that a
+ * child's writes to a file mapping it inherited through fork stay its
+ * own and never reach the file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 8
+#define FILEPAGES 3
+#define FILENAME "mmaptest.dat"
+
+static char buf[PAGE_SIZE];
+
+static
+char *
+domap(size_t length, int prot, int fd, off_t offset)
+{
+	void *p;
+
+	p = mmap(length, prot, fd, offset);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+/*
+ * Touch *P in a child process and check that it is killed for it.
+ */
+static
+void
+crashes(volatile char *p, const char *what)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		(void)*p;
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV) {
+		errx(1, "FAILED: %s did not fault", what);
+	}
+}
+
+static
+void
+test_anon(void)
+{
+	char *p;
+	unsigned i;
+
+	p = domap(NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE, -1, 0);
+	for (i = 0; i < NPAGES * PAGE_SIZE; i++) {
+		if (p[i] != 0) {
+			errx(1, "FAILED: anonymous mapping not zeroed");
+		}
+	}
+	for (i = 0; i < NPAGES; i++) {
+		memset(p + i * PAGE_SIZE, 'a' + i, PAGE_SIZE);
+	}
+	for (i = 0; i < NPAGES * PAGE_SIZE; i++) {
+		if (p[i] != (char)('a' + i / PAGE_SIZE)) {
+			errx(1, "FAILED: anonymous mapping lost data");
+		}
+	}
+
+	if (munmap(p) < 0) {
+		err(1, "munmap");
+	}
+	crashes(p, "unmapped page");
+	if (munmap(p) == 0 || errno != EINVAL) {
+		errx(1, "FAILED: second munmap did not fail with EINVAL");
+	}
+	printf("Passed anonymous mapping test.\n");
+}
+
+static
+void
+test_file(void)
+{
+	char *p;
+	unsigned i;
+	int fd;
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (i = 0; i < FILEPAGES; i++) {
+		memset(buf, '0' + i, PAGE_SIZE);
+		if (write(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+
+	p = domap(FILEPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE, fd, 0);
+	for (i = 0; i < FILEPAGES * PAGE_SIZE; i++) {
+		if (p[i] != (char)('0' + i / PAGE_SIZE)) {
+			errx(1, "FAILED: file mapping does not match the file");
+		}
+	}
+
+	/* change the middle of each page, then unmap to write it back */
+	for (i = 0; i < FILEPAGES; i++) {
+		memset(p + i * PAGE_SIZE + PAGE_SIZE / 4, 'x', PAGE_SIZE / 2);
+	}
+	if (munmap(p) < 0) {
+		err(1, "munmap");
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "%s: lseek", FILENAME);
+	}
+	for (i = 0; i < FILEPAGES; i++) {
+		if (read(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			err(1, "%s: read", FILENAME);
+		}
+		if (buf[0] != (char)('0' + i) ||
+		    buf[PAGE_SIZE / 4] != 'x' ||
+		    buf[PAGE_SIZE * 3 / 4 - 1] != 'x' ||
+		    buf[PAGE_SIZE * 3 / 4] != (char)('0' + i)) {
+			errx(1, "FAILED: writes to the mapping did not "
+			     "reach the file");
+		}
+	}
+	close(fd);
+
+	/* a file open for reading only can't be mapped writeable */
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	if (mmap(PAGE_SIZE, PROT_READ | PROT_WRITE, fd, 0) != (void *)-1 ||
+	    errno != EACCES) {
+		errx(1, "FAILED: writeable mapping of a read-only file");
+	}
+	close(fd);
+	remove(FILENAME);
+
+	printf("Passed file mapping test.\n");
+}
+
+/*
+ * A forked child's copy of a file mapping is private: it sees what the
+ * parent wrote before the fork, but its own writes reach neither the
+ * parent nor the file.
+ */
+static
+void
+test_fork(void)
+{
+	char *p;
+	unsigned i;
+	pid_t pid;
+	int fd, status;
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (i = 0; i < FILEPAGES; i++) {
+		memset(buf, '0' + i, PAGE_SIZE);
+		if (write(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+
+	p = domap(FILEPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE, fd, 0);
+	memset(p, 'p', PAGE_SIZE);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (p[0] != 'p' || p[PAGE_SIZE - 1] != 'p') {
+			errx(1, "FAILED: child does not see the parent's "
+			     "writes");
+		}
+		memset(p, 'c', 2 * PAGE_SIZE);
+		if (munmap(p) < 0) {
+			err(1, "munmap");
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child failed");
+	}
+
+	if (p[0] != 'p' || p[PAGE_SIZE] != '1') {
+		errx(1, "FAILED: child's writes reached the parent");
+	}
+	if (munmap(p) < 0) {
+		err(1, "munmap");
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "%s: lseek", FILENAME);
+	}
+	for (i = 0; i < FILEPAGES; i++) {
+		if (read(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			err(1, "%s: read", FILENAME);
+		}
+		if (buf[0] != (i == 0 ? 'p' : (char)('0' + i)) ||
+		    buf[PAGE_SIZE - 1] != buf[0]) {
+			errx(1, "FAILED: page %u of the file holds '%c'",
+			     i, buf[0]);
+		}
+	}
+	close(fd);
+	remove(FILENAME);
+
+	printf("Passed file mapping after fork test.\n");
+}
+
+int
+main(void)
+{
+	test_anon();
+	test_file();
+	test_fork();
+	printf("mmaptest done.\n");
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * mprotest - check mprotect() and madvise().
+ *
+ * Checks that pages made read-only can be read but not written, that
+ * pages with no access can't be touched at all, that their contents
+ * survive being protected, and that MADV_DONTNEED gives back pages
+ * that read as zero afterwards.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 4
+
+static
+char *
+domap(size_t length)
+{
+	void *p;
+
+	p = mmap(length, PROT_READ | PROT_WRITE, -1, 0);
+	if (p == (void *)-1) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+static
+void
+doprotect(char *p, size_t length, int prot)
+{
+	if (mprotect(p, length, prot) < 0) {
+		err(1, "mprotect");
+	}
+}
+
+/*
+ * Read or write *P in a child process and return whether the child
+ * was killed for it.
+ */
+static
+bool
+faults(volatile char *p, bool write)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (write) {
+			*p = 'w';
+		}
+		else {
+			(void)*p;
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFSIGNALED(status)) {
+		if (WTERMSIG(status) != SIGSEGV) {
+			errx(1, "FAILED: child: Signal %d", WTERMSIG(status));
+		}
+		return true;
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child: Exit %d", WEXITSTATUS(status));
+	}
+	return false;
+}
+
+static
+void
+test_protect(void)
+{
+	char *p;
+	unsigned i;
+
+	p = domap(NPAGES * PAGE_SIZE);
+	memset(p, 'p', NPAGES * PAGE_SIZE);
+
+	/* the second page read-only, the third no access */
+	doprotect(p + PAGE_SIZE, PAGE_SIZE, PROT_READ);
+	doprotect(p + 2 * PAGE_SIZE, PAGE_SIZE, 0);
+
+	if (faults(p, true) || faults(p + 3 * PAGE_SIZE, true)) {
+		errx(1, "FAILED: untouched pages fault");
+	}
+	if (faults(p + PAGE_SIZE, false)) {
+		errx(1, "FAILED: read-only page can't be read");
+	}
+	if (!faults(p + PAGE_SIZE, true)) {
+		errx(1, "FAILED: read-only page can be written");
+	}
+	if (!faults(p + 2 * PAGE_SIZE, false)) {
+		errx(1, "FAILED: page with no access can be read");
+	}
+
+	/* everything back, with the contents as they were */
+	doprotect(p, NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE);
+	for (i = 0; i < NPAGES * PAGE_SIZE; i++) {
+		if (p[i] != 'p') {
+			errx(1, "FAILED: data lost across mprotect");
+		}
+	}
+	p[PAGE_SIZE] = 'w';
+	p[2 * PAGE_SIZE] = 'w';
+
+	/* pages that aren't mapped */
+	if (mprotect(p + NPAGES * PAGE_SIZE, PAGE_SIZE, PROT_READ) == 0 ||
+	    errno != ENOMEM) {
+		errx(1, "FAILED: mprotect of unmapped pages did not fail "
+		     "with ENOMEM");
+	}
+
+	if (munmap(p) < 0) {
+		err(1, "munmap");
+	}
+	printf("Passed mprotect test.\n");
+}
+
+static
+void
+test_dontneed(void)
+{
+	char *p;
+	unsigned i;
+
+	p = domap(NPAGES * PAGE_SIZE);
+	memset(p, 'd', NPAGES * PAGE_SIZE);
+
+	/* give back the middle two pages */
+	if (madvise(p + PAGE_SIZE, 2 * PAGE_SIZE, MADV_DONTNEED) < 0) {
+		err(1, "madvise");
+	}
+	for (i = 0; i < NPAGES * PAGE_SIZE; i++) {
+		bool inside = i >= PAGE_SIZE && i < 3 * PAGE_SIZE;
+		if (p[i] != (inside ? 0 : 'd')) {
+			errx(1, "FAILED: page %u %s after MADV_DONTNEED",
+			     i / PAGE_SIZE, inside ? "not zero" : "changed");
+		}
+	}
+
+	if (madvise(p, PAGE_SIZE, 99) == 0 || errno != EINVAL) {
+		errx(1, "FAILED: bad advice did not fail with EINVAL");
+	}
+
+	if (munmap(p) < 0) {
+		err(1, "munmap");
+	}
+	printf("Passed madvise test.\n");
+}
+
+int
+main(void)
+{
+	test_protect();
+	test_dontneed();
+	printf("mprotest done.\n");
+	return 0;
+}
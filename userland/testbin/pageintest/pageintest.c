@@ -0,0 +1,88 @@
+/*
+ * pageintest - check that executables are paged in correctly.
+ *
+ * Carries 256k of read-only tables and 256k of initialized data, which
+ * the kernel reads in from the executable a page at a time as they are
+ * first touched. Touches their pages in a scrambled order, checking
+ * every word, then writes the data pages and checks them again.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+#define NPAGES 64
+
+#define V(n)    ((n) * 2654435761U + 12345)
+#define R4(n)   V(n), V((n) + 1), V((n) + 2), V((n) + 3)
+#define R16(n)  R4(n), R4((n) + 4), R4((n) + 8), R4((n) + 12)
+#define R64(n)  R16(n), R16((n) + 16), R16((n) + 32), R16((n) + 48)
+#define R256(n) R64(n), R64((n) + 64), R64((n) + 128), R64((n) + 192)
+#define R1K(n)  R256(n), R256((n) + 256), R256((n) + 512), R256((n) + 768)
+#define R4K(n)  R1K(n), R1K((n) + 1024), R1K((n) + 2048), R1K((n) + 3072)
+#define R16K(n) R4K(n), R4K((n) + 4096), R4K((n) + 8192), R4K((n) + 12288)
+#define R64K(n) R16K(n), R16K((n) + 16384), R16K((n) + 32768), \
+		R16K((n) + 49152)
+
+static const unsigned table[NPAGES * WORDS] = { R64K(0) };
+static unsigned data[NPAGES * WORDS] = { R64K(0) };
+
+/*
+ * Check page P of T, which should hold the initial values plus DELTA.
+ */
+static
+void
+check(const unsigned *t, unsigned p, unsigned delta, const char *what)
+{
+	unsigned i, n;
+
+	for (i = 0; i < WORDS; i++) {
+		n = p * WORDS + i;
+		if (t[n] != V(n) + delta) {
+			errx(1, "FAILED: %s page %u word %u is 0x%x, "
+			     "expected 0x%x", what, p, i, t[n], V(n) + delta);
+		}
+	}
+}
+
+/*
+ * The pages in a scrambled order: 37 is odd, so stepping by it visits
+ * each of the 64 pages once.
+ */
+static
+unsigned
+scramble(unsigned k)
+{
+	return (k * 37 + 11) % NPAGES;
+}
+
+int
+main(void)
+{
+	unsigned k, i, p;
+
+	for (k = 0; k < NPAGES; k++) {
+		check(table, scramble(k), 0, "read-only");
+		check(data, scramble(NPAGES - 1 - k), 0, "data");
+	}
+	printf("Passed page-in test.\n");
+
+	for (k = 0; k < NPAGES; k += 2) {
+		p = scramble(k);
+		for (i = 0; i < WORDS; i++) {
+			data[p * WORDS + i] += 1;
+		}
+	}
+	for (k = 0; k < NPAGES; k++) {
+		check(data, scramble(k), k % 2 == 0 ? 1 : 0, "written data");
+		check(table, scramble(k), 0, "read-only");
+	}
+	printf("Passed data write test.\n");
+
+	printf("pageintest done.\n");
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * pttest - stress sparse mappings and their page tables.
+ *
+ * Maps many areas of several 4M (one level 2 page table each) and
+ * touches only a few pages scattered over them, then unmaps them in
+ * a scrambled order and maps them again, many times over. Checks
+ * every page written keeps its contents, including in a child after
+ * fork, that mincore() reports just the pages written, and that
+ * memory mapped in again starts out zero.
+ *
+ * Run it when memory isn't short, or pages may be paged out under it.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define TABLESPAN (1024 * PAGE_SIZE)	/* what one level 2 table maps */
+#define NAREAS 16
+#define AREASIZE (3 * TABLESPAN)
+#define AREAPAGES (AREASIZE / PAGE_SIZE)
+#define NTOUCH 5
+#define ROUNDS 10
+#define FAULTAROUND 16	/* the most pages the kernel maps on one fault */
+
+static unsigned *areas[NAREAS];
+
+/*
+ * The pages touched in each area: a few, spread over its tables, and
+ * all different as 4 * 613 < AREAPAGES.
+ */
+static
+unsigned
+touched(unsigned a, unsigned k)
+{
+	return (a * 97 + k * 613) % AREAPAGES;
+}
+
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+
+static
+unsigned *
+word(unsigned a, unsigned page)
+{
+	return areas[a] + page * WORDS;
+}
+
+static
+void
+map(unsigned a)
+{
+	unsigned k;
+
+	areas[a] = mmap(AREASIZE, PROT_READ | PROT_WRITE, -1, 0);
+	if (areas[a] == (void *)-1) {
+		err(1, "mmap");
+	}
+	for (k = 0; k < NTOUCH; k++) {
+		*word(a, touched(a, k)) = a * 1000 + k + 1;
+		if (word(a, touched(a, k))[WORDS - 1] != 0) {
+			errx(1, "FAILED: area %u page %u not zero when mapped",
+			     a, touched(a, k));
+		}
+	}
+}
+
+static
+void
+check(unsigned a, const char *what)
+{
+	static char vec[AREAPAGES];
+	unsigned k, p, n;
+
+	for (k = 0; k < NTOUCH; k++) {
+		if (*word(a, touched(a, k)) != a * 1000 + k + 1) {
+			errx(1, "FAILED: %s: area %u page %u holds %u", what,
+			     a, touched(a, k), *word(a, touched(a, k)));
+		}
+	}
+
+	if (mincore(areas[a], AREASIZE, vec) < 0) {
+		err(1, "mincore");
+	}
+	for (k = 0; k < NTOUCH; k++) {
+		if (!vec[touched(a, k)]) {
+			errx(1, "FAILED: %s: area %u page %u not resident",
+			     what, a, touched(a, k));
+		}
+	}
+	/*
+	 * A read that faults can map the zero page in around the page it
+	 * reads, a window of FAULTAROUND pages, but no more than that.
+	 */
+	n = 0;
+	for (p = 0; p < AREAPAGES; p++) {
+		n += vec[p];
+	}
+	if (n > NTOUCH * FAULTAROUND) {
+		errx(1, "FAILED: %s: area %u has %u pages resident", what,
+		     a, n);
+	}
+}
+
+int
+main(void)
+{
+	unsigned a, r, k;
+	pid_t pid;
+	int status;
+
+	for (a = 0; a < NAREAS; a++) {
+		map(a);
+	}
+	for (a = 0; a < NAREAS; a++) {
+		check(a, "first mapping");
+	}
+	printf("Passed sparse mapping test.\n");
+
+	for (r = 0; r < ROUNDS; r++) {
+		/* 7 is odd, so this unmaps half the areas in a new order */
+		for (k = 0; k < NAREAS / 2; k++) {
+			a = (k * 7 + r) % NAREAS;
+			if (munmap(areas[a]) < 0) {
+				err(1, "munmap");
+			}
+			areas[a] = NULL;
+		}
+		for (a = 0; a < NAREAS; a++) {
+			if (areas[a] == NULL) {
+				map(a);
+			}
+		}
+		for (a = 0; a < NAREAS; a++) {
+			check(a, "remapping");
+		}
+	}
+	printf("Passed unmap and remap test.\n");
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (a = 0; a < NAREAS; a++) {
+			check(a, "child");
+		}
+		for (a = 0; a < NAREAS; a += 2) {
+			if (munmap(areas[a]) < 0) {
+				err(1, "munmap");
+			}
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child failed");
+	}
+	for (a = 0; a < NAREAS; a++) {
+		check(a, "after fork");
+		if (munmap(areas[a]) < 0) {
+			err(1, "munmap");
+		}
+	}
+	printf("Passed sparse fork test.\n");
+
+	printf("pttest done.\n");
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * scantest - check sequential and strided scans over many pages.
+ *
+ * Writes every third page of a large array, then reads the whole of it
+ * forwards, backwards and with assorted strides, so that faults map
+ * neighbouring pages of every kind at once: written pages, untouched
+ * ones and ones still shared with a parent. Every word read is
+ * checked.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 512
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+
+static unsigned pages[NPAGES][WORDS];
+
+static
+unsigned
+expected(unsigned p, unsigned i)
+{
+	return p % 3 == 0 ? p * WORDS + i + 1 : 0;
+}
+
+static
+void
+check(unsigned p, const char *what)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		if (pages[p][i] != expected(p, i)) {
+			errx(1, "FAILED: %s: page %u word %u is %u, "
+			     "expected %u", what, p, i, pages[p][i],
+			     expected(p, i));
+		}
+	}
+}
+
+/*
+ * Read every page, starting at page FIRST and stepping by STRIDE,
+ * which must be odd so that every page gets visited.
+ */
+static
+void
+scan(unsigned first, unsigned stride, const char *what)
+{
+	unsigned k;
+
+	for (k = 0; k < NPAGES; k++) {
+		check((first + k * stride) % NPAGES, what);
+	}
+}
+
+int
+main(void)
+{
+	unsigned p, i;
+	pid_t pid;
+	int status;
+
+	for (p = 0; p < NPAGES; p += 3) {
+		for (i = 0; i < WORDS; i++) {
+			pages[p][i] = expected(p, i);
+		}
+	}
+
+	scan(0, 1, "forward scan");
+	scan(NPAGES - 1, NPAGES - 1, "backward scan");
+	scan(0, 5, "stride 5 scan");
+	scan(7, 17, "stride 17 scan");
+	printf("Passed scan test.\n");
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		scan(0, 1, "child forward scan");
+		scan(3, 33, "child stride 33 scan");
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child failed");
+	}
+	scan(0, 1, "forward scan after fork");
+	printf("Passed scan after fork test.\n");
+
+	printf("scantest done.\n");
+	return 0;
+}
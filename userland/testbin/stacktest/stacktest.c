@@ -0,0 +1,74 @@
+/*
+ * stacktest - check that the stack grows on demand.
+ *
+ * Recurses with a page-sized frame well past the 16 pages the stack
+ * used to be limited to, checking every frame on the way back up, and
+ * then checks that a child recursing past the stack limit (256 pages
+ * unless changed in the kernel) is killed rather than running into
+ * whatever lies below.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define DEEP 160	/* pages; well past 16, well short of the limit */
+#define TOODEEP 512	/* pages; past the default limit of 256 */
+
+static
+unsigned
+recurse(unsigned depth)
+{
+	volatile char frame[PAGE_SIZE];
+	unsigned i, sum;
+
+	for (i = 0; i < PAGE_SIZE; i += 512) {
+		frame[i] = (char)depth;
+	}
+	sum = depth > 0 ? recurse(depth - 1) : 0;
+	for (i = 0; i < PAGE_SIZE; i += 512) {
+		if (frame[i] != (char)depth) {
+			errx(1, "FAILED: stack frame %u corrupted", depth);
+		}
+	}
+	return sum + 1;
+}
+
+int
+main(void)
+{
+	pid_t pid;
+	int status;
+
+	printf("Recursing %u pages deep...\n", DEEP);
+	if (recurse(DEEP) != DEEP + 1) {
+		errx(1, "FAILED: wrong recursion depth");
+	}
+	printf("Passed stack growth test.\n");
+
+	printf("Recursing %u pages deep in a child; this should produce "
+	       "fatal signal 11 (SIGSEGV).\n", TOODEEP);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		recurse(TOODEEP);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV) {
+		errx(1, "FAILED: child went past the stack limit");
+	}
+	printf("Passed stack limit test.\n");
+
+	printf("stacktest done.\n");
+	return 0;
+}
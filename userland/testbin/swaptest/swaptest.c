@@ -0,0 +1,232 @@
+/*
+ * swaptest - check that pages survive being paged out and back in.
+ *
+ * Usage: swaptest [-c] [-p nprocs] [npages]
+ *
+ * Writes a pattern over NPAGES pages (1024, 4M, unless given; up to
+ * 2048), which should be more than the machine has memory for, then
+ * reads them all back, rewrites half of them and reads them all again,
+ * in order, in reverse and with a stride, so swap read-ahead gets both
+ * runs it can use and runs it can't. Then it keeps a small hot set of
+ * pages in use while sweeping over the rest, which exercises the clock
+ * hand's second chances. Every word of every page is checked. Run it
+ * with sys161 configured with a swap disk larger than NPAGES pages.
+ *
+ * With -c the pages compress well: some are all zeroes, and the rest
+ * alternate runs of one repeated word with stretches of varied ones,
+ * so the kernel can keep them in its compressed pool instead.
+ *
+ * With -p, NPROCS processes (up to 8) run the test at once, each on
+ * NPAGES pages with contents of its own, so they page against each
+ * other and the pageout thread has to keep up with all of them. Only
+ * the first one reports its progress.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define MAXPAGES 2048
+#define DEFPAGES 1024
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+#define HOTPAGES 16
+#define MAXPROCS 8
+#define STRIDE 7
+
+static unsigned pages[MAXPAGES][WORDS];
+static unsigned npages = DEFPAGES;
+static int compressible;
+static unsigned proc;	/* which of the processes this is */
+
+static
+unsigned
+pattern(unsigned page, unsigned word, unsigned gen)
+{
+	if (compressible) {
+		if (page % 7 == 0 && gen == 0) {
+			return 0;
+		}
+		if ((word / 64) % 2 == 1) {
+			return (proc * MAXPAGES + page) * 64 + word / 64 + gen;
+		}
+	}
+	return ((proc * MAXPAGES + page) * WORDS + word) * 2654435761U + gen;
+}
+
+static
+void
+fill(unsigned page, unsigned gen)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		pages[page][i] = pattern(page, i, gen);
+	}
+}
+
+static
+void
+check(unsigned page, unsigned gen, const char *phase)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		if (pages[page][i] != pattern(page, i, gen)) {
+			errx(1, "FAILED: %s: page %u word %u is 0x%x, "
+			     "expected 0x%x", phase, page, i, pages[page][i],
+			     pattern(page, i, gen));
+		}
+	}
+}
+
+/*
+ * Sweep over the pages above the hot set, bumping a counter in one of
+ * the hot pages between each, so the hot pages are used all the time
+ * and the rest only once per sweep.
+ */
+static
+void
+hotset(unsigned sweeps)
+{
+	unsigned p, s, count[HOTPAGES];
+
+	for (p = 0; p < HOTPAGES; p++) {
+		pages[p][0] = 0;
+		count[p] = 0;
+	}
+	for (s = 0; s < sweeps; s++) {
+		for (p = HOTPAGES; p < npages; p++) {
+			check(p, p % 2, "hot set sweep");
+			pages[p % HOTPAGES][0]++;
+			count[p % HOTPAGES]++;
+		}
+	}
+	for (p = 0; p < HOTPAGES; p++) {
+		if (pages[p][0] != count[p]) {
+			errx(1, "FAILED: hot page %u counted %u, expected %u",
+			     p, pages[p][0], count[p]);
+		}
+		fill(p, p % 2);
+	}
+}
+
+static
+void
+progress(const char *msg)
+{
+	if (proc == 0) {
+		printf("%s\n", msg);
+	}
+}
+
+static
+void
+run(void)
+{
+	unsigned p, i;
+
+	progress(compressible ? "Writing compressible pages..." :
+		 "Writing pages...");
+	for (p = 0; p < npages; p++) {
+		fill(p, 0);
+	}
+	progress("Reading them back...");
+	for (p = 0; p < npages; p++) {
+		check(p, 0, "first read");
+	}
+	progress("Passed page-out test.");
+
+	progress("Rewriting every other page...");
+	for (p = 1; p < npages; p += 2) {
+		fill(p, 1);
+	}
+	for (p = 0; p < npages; p++) {
+		check(p, p % 2, "second read");
+	}
+	progress("Passed rewrite test.");
+
+	progress("Reading back in reverse and with a stride...");
+	for (p = npages; p-- > 0; ) {
+		check(p, p % 2, "reverse read");
+	}
+	for (i = 0; i < STRIDE; i++) {
+		for (p = i; p < npages; p += STRIDE) {
+			check(p, p % 2, "strided read");
+		}
+	}
+	progress("Passed out of order read test.");
+
+	progress("Sweeping with the hot pages...");
+	hotset(3);
+	progress("Passed hot set test.");
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: swaptest [-c] [-p nprocs] [npages], nprocs up to "
+	     "%u, npages from %u up to %u", MAXPROCS, HOTPAGES + 1,
+	     MAXPAGES);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pid_t pids[MAXPROCS];
+	unsigned nprocs = 1, i;
+	int arg = 1, status, failed = 0;
+
+	if (argc > arg && strcmp(argv[arg], "-c") == 0) {
+		compressible = 1;
+		arg++;
+	}
+	if (argc > arg + 1 && strcmp(argv[arg], "-p") == 0) {
+		nprocs = atoi(argv[arg + 1]);
+		if (nprocs < 1 || nprocs > MAXPROCS) {
+			usage();
+		}
+		arg += 2;
+	}
+	if (argc > arg) {
+		npages = atoi(argv[arg]);
+		if (npages <= HOTPAGES || npages > MAXPAGES) {
+			usage();
+		}
+	}
+
+	printf("Running %u process%s on %u pages each...\n", nprocs,
+	       nprocs == 1 ? "" : "es", npages);
+	for (i = 1; i < nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			proc = i;
+			run();
+			_exit(0);
+		}
+	}
+	run();
+	for (i = 1; i < nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED: another process lost its pages");
+	}
+
+	printf("swaptest done.\n");
+	return 0;
+}
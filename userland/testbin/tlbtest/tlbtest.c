@@ -0,0 +1,88 @@
+/*
+ * tlbtest - stress TLB refills and address space switches.
+ *
+ * Runs several processes at once, each sweeping over more pages than
+ * the TLB holds in a scrambled order, many times over. Every page
+ * holds a counter and the process's own tag, so a refill that loads
+ * another page, or another process's page, is caught.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 128	/* twice the 64 entries of the TLB */
+#define NPROCS 4
+#define ROUNDS 50
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+
+static unsigned pages[NPAGES][WORDS];
+
+static
+void
+sweep(unsigned tag)
+{
+	unsigned r, k, p;
+
+	for (p = 0; p < NPAGES; p++) {
+		pages[p][0] = tag;
+		pages[p][WORDS - 1] = p;
+		pages[p][1] = 0;
+	}
+
+	for (r = 0; r < ROUNDS; r++) {
+		for (k = 0; k < NPAGES; k++) {
+			/* 77 is odd, so this visits every page once */
+			p = (k * 77 + r) % NPAGES;
+			if (pages[p][0] != tag || pages[p][WORDS - 1] != p ||
+			    pages[p][1] != r) {
+				errx(1, "FAILED: process %u round %u: page %u "
+				     "holds tag %u page %u count %u", tag, r,
+				     p, pages[p][0], pages[p][WORDS - 1],
+				     pages[p][1]);
+			}
+			pages[p][1]++;
+		}
+	}
+}
+
+int
+main(void)
+{
+	pid_t pids[NPROCS];
+	unsigned i;
+	int status, failed = 0;
+
+	for (i = 0; i < NPROCS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			sweep(i + 1);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < NPROCS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED: a process saw the wrong page");
+	}
+	printf("Passed concurrent sweep test.\n");
+
+	sweep(0);
+	printf("Passed single process sweep test.\n");
+
+	printf("tlbtest done.\n");
+	return 0;
+}
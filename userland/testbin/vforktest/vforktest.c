@@ -0,0 +1,77 @@
+/*
+ * vforktest - check vfork().
+ *
+ * A vfork child runs in its parent's address space, and the parent
+ * waits until the child calls _exit or execs. So a store the child
+ * makes before _exit must be visible to the parent as soon as vfork
+ * returns there, and a child that execs must leave the parent's
+ * memory alone.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+static volatile int shared;
+static char *trueargs[] = { (char *)"true", NULL };
+
+static
+void
+dowait(pid_t pid, int expect)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFSIGNALED(status)) {
+		errx(1, "FAILED: child: Signal %d", WTERMSIG(status));
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != expect) {
+		errx(1, "FAILED: child: Exit %d, expected %d",
+		     WEXITSTATUS(status), expect);
+	}
+}
+
+int
+main(void)
+{
+	pid_t pid;
+
+	/* the child's store lands in our memory before we go on */
+	shared = 1;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		shared = 2;
+		_exit(3);
+	}
+	if (shared != 2) {
+		errx(1, "FAILED: parent ran before the child was done, "
+		     "or not in the same memory");
+	}
+	dowait(pid, 3);
+	printf("Passed vfork and _exit test.\n");
+
+	/* a child that execs gives our address space back untouched */
+	shared = 4;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		execv("/bin/true", trueargs);
+		_exit(1);
+	}
+	if (shared != 4) {
+		errx(1, "FAILED: exec changed the parent's memory");
+	}
+	dowait(pid, 0);
+	printf("Passed vfork and exec test.\n");
+
+	printf("vforktest done.\n");
+	return 0;
+}
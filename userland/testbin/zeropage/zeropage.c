@@ -0,0 +1,96 @@
+/*
+ * zeropage - check pages first read before they are written.
+ *
+ * Reads through a large untouched array, which the kernel may map to
+ * one shared page of zeros, then writes some of its pages and checks
+ * that only those changed, in this process and in a forked child.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/* OS/161 doesn't currently have a way to get this from the kernel. */
+#define PAGE_SIZE 4096
+
+#define NPAGES 256
+#define WORDS (PAGE_SIZE / sizeof(unsigned))
+
+static unsigned zeros[NPAGES][WORDS];
+
+/*
+ * Check that page P holds VAL in every word.
+ */
+static
+void
+check(unsigned p, unsigned val, const char *what)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		if (zeros[p][i] != val) {
+			errx(1, "FAILED: %s: page %u word %u is %u, "
+			     "expected %u", what, p, i, zeros[p][i], val);
+		}
+	}
+}
+
+static
+void
+fill(unsigned p, unsigned val)
+{
+	unsigned i;
+
+	for (i = 0; i < WORDS; i++) {
+		zeros[p][i] = val;
+	}
+}
+
+int
+main(void)
+{
+	unsigned p;
+	pid_t pid;
+	int status;
+
+	for (p = 0; p < NPAGES; p++) {
+		check(p, 0, "untouched");
+	}
+	printf("Passed untouched read test.\n");
+
+	for (p = 0; p < NPAGES; p += 3) {
+		fill(p, p + 1);
+	}
+	for (p = 0; p < NPAGES; p++) {
+		check(p, p % 3 == 0 ? p + 1 : 0, "after writes");
+	}
+	printf("Passed write after read test.\n");
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (p = 1; p < NPAGES; p += 3) {
+			fill(p, p + 1);
+		}
+		for (p = 0; p < NPAGES; p++) {
+			check(p, p % 3 == 2 ? 0 : p + 1, "child");
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "FAILED: child failed");
+	}
+	for (p = 0; p < NPAGES; p++) {
+		check(p, p % 3 == 0 ? p + 1 : 0, "parent after fork");
+	}
+	printf("Passed fork test.\n");
+
+	printf("zeropage done.\n");
+	return 0;
+}